@@ -10,11 +10,15 @@ You should have received a copy of the GNU General Public License along with thi
 */
 
 #include <curl/curl.h>
+#include <libxml/parser.h>
 
 typedef struct {
 	const char *url;
 	const char *feedName;
 	const time_t update;
+	const unsigned long maxItems;
+	const time_t maxAge;
+	const unsigned long long maxBytes;
 } linkStruct;
 
 /* Example link:
@@ -24,6 +28,12 @@ typedef struct {
 		.feedName = "examplefeed",
 		// The time in seconds between checks for updates.
 		.update = 3600,
+		// Optional retention limits: the oldest articles are deleted
+		// once the feed has more articles, older articles (in seconds)
+		// or more bytes than this. 0 means no limit.
+		.maxItems = 500,
+		.maxAge = 30 * 24 * 3600,
+		.maxBytes = 0,
 	},
 */
 
@@ -44,8 +54,19 @@ enum logLevels {
 };
 
 // Print all messages at least as important as this level.
+// This can be changed when running with '-l level'.
 static const int logLevel = LOG_OUTPUT;
 
+enum logFormats {
+	// minrss: message
+	LOG_FORMAT_TEXT,
+	// One JSON object per line, with the time, level, feed and message.
+	// Also enabled by '-j'. Does not affect LOG_OUTPUT.
+	LOG_FORMAT_JSON,
+};
+
+static const enum logFormats logFormat = LOG_FORMAT_TEXT;
+
 // Set the maximum amount of redirects curl will follow.
 // Use 0 to disable redirects, and -1 for no limit.
 static const int maxRedirs = 10;
@@ -54,6 +75,117 @@ static const int maxRedirs = 10;
 // For more information: https://curl.se/libcurl/c/CURLOPT_PROTOCOLS_STR.html
 static const char curlProtocols[] = "http,https";
 
+// Timeouts in seconds for connecting and for a whole transfer.
+// Use 0 for no limit.
+static const long connectTimeout = 15;
+static const long requestTimeout = 60;
+
+// Abort transfers slower than lowSpeedLimit bytes per second for
+// lowSpeedTime seconds. Use 0 to disable.
+static const long lowSpeedLimit = 10;
+static const long lowSpeedTime = 20;
+
+// Retry transient failures (timeouts, connection errors, HTTP 429 and 5xx)
+// up to maxRetries times, waiting about retryBaseDelay milliseconds, then
+// twice as long each time, up to retryMaxDelay.
+// A Retry-After longer than retryMaxDelay is not waited for.
+static const int maxRetries = 2;
+static const long long retryBaseDelay = 1000;
+static const long long retryMaxDelay = 8000;
+
+// After breakerThreshold updates of a feed fail in a row, stop polling it
+// for breakerBaseDelay seconds, doubling with every further failure up to
+// breakerMaxDelay.
+static const unsigned long breakerThreshold = 3;
+static const time_t breakerBaseDelay = 3600;
+static const time_t breakerMaxDelay = 7 * 24 * 3600;
+
+// Limits applied to each feed, so a broken or malicious feed can not use up
+// all memory or time. Violations are logged and counted in the run stats.
+// Larger feeds are not downloaded (in bytes).
+static const curl_off_t maxFeedSize = 16 * 1024 * 1024;
+// Only the first maxFeedItems articles of a feed are saved.
+static const unsigned long maxFeedItems = 1000;
+// Longer titles, links and descriptions are truncated (in bytes).
+static const size_t maxFieldLen = 1024 * 1024;
+// Time allowed to parse a feed, in milliseconds. A feed whose XML is not read
+// by then is skipped, and once it is, only the articles read in time are saved.
+static const long long maxParseTime = 5000;
+// libxml2 keeps its default limits on nesting depth and entity expansion,
+// as XML_PARSE_HUGE is never set. These options are added when parsing.
+static const int xmlOptions = XML_PARSE_NONET;
+
+// Also download the page each new article links to, saved next to the
+// article as [article].page.html.
+static const int prefetchPages = 0;
+// Parallel connections used for pages, in total and to a single host.
+static const long prefetchConnections = 16;
+static const long prefetchHostConnections = 2;
+
+// Download the enclosures of new articles (podcast episodes, videos...),
+// saved next to the article as [article].enclosure.[ext].
+// Interrupted downloads are resumed on the next run.
+static const int downloadEnclosures = 0;
+// Only download enclosures whose MIME type starts with one of these.
+// Use "" to download every enclosure.
+static const char *const enclosureTypes[] = {
+	"audio/",
+	"video/",
+};
+// Parallel connections used for enclosures, in total and to a single host.
+static const long enclosureConnections = 4;
+static const long enclosureHostConnections = 4;
+// Download enclosures of at least enclosureSegmentSize bytes (as given by
+// the feed) as this many ranges in parallel. Use 1 to disable.
+static const int enclosureSegments = 4;
+static const curl_off_t enclosureSegmentSize = 32 * 1024 * 1024;
+// Total download speed for enclosures in bytes per second, 0 for no limit.
+static const curl_off_t enclosureBandwidth = 0;
+
+enum netDrivers {
+	// Wait with curl_multi_poll and check every transfer on each wakeup.
+	DRIVER_POLL,
+	// Linux only: wait with epoll and only service sockets with activity.
+	// Falls back to DRIVER_POLL elsewhere.
+	DRIVER_EPOLL,
+};
+
+// Sets how transfers are driven. DRIVER_EPOLL scales better to many feeds.
+static const enum netDrivers netDriver = DRIVER_EPOLL;
+
+// With 'minrss serve', look for feeds that are due this often, in seconds.
+static const long serveInterval = 60;
+
+// With 'minrss serve', feeds that name a WebSub hub are subscribed to it, and
+// are not polled while the hub pushes their updates. callbackUrl is the
+// address where hubs can reach MinRSS, ending with a slash, such as
+// "https://example.com/minrss/". Leave it empty to only poll.
+static const char callbackUrl[] = "";
+// Address and port to listen on for hubs
+static const char listenAddr[] = "0.0.0.0";
+static const char listenPort[] = "8790";
+// Subscription length to ask hubs for, in seconds
+static const long leaseSeconds = 7 * 24 * 3600;
+
+// Ask servers for only the articles added since the last update
+// (RFC 3229 "A-IM: feed"). Servers without support send the whole feed.
+static const int deltaFeeds = 1;
+
+// Remember the addresses of hosts between runs for this many seconds, so
+// that each run does not start by resolving every host again.
+// Set to 0 to disable.
+static const long dnsCacheTime = 3600;
+
+// Resolve the hosts of feeds that are due within this many seconds, if
+// their cached address expires before then. Hosts are only looked up, not
+// connected to, but each lookup holds up the run. Set to 0 to disable.
+static const long dnsPrefetchTime = 0;
+
+// With 'minrss --shard i/N', assign feeds to shards by host name instead of
+// by URL, so that feeds on the same server share a process and its
+// connections.
+static const int shardByHost = 1;
+
 enum outputFormats {
 	OUTPUT_HTML,
 #ifdef JSON
@@ -61,6 +193,18 @@ enum outputFormats {
 #endif // JSON
 };
 
+// Store articles that several feeds share only once, hard linked into each
+// feed folder. The files then leave out the name of the feed.
+static const int dedupArticles = 0;
+
+// Name articles so that they are never merged: transliterate non-ASCII
+// titles, and append a short hash of each article's GUID or link. When 0,
+// articles are named as in MinRSS 0.4, which drops non-ASCII characters, so
+// articles with the same title (or titles in other scripts) share one file.
+// Enabling it renames every article, so the articles already saved are
+// saved once more under their new name on the next update.
+static const int nameHash = 0;
+
 // When saving, sets the format of the saved file.
 static const enum outputFormats outputFormat = OUTPUT_HTML;
 
@@ -90,3 +234,12 @@ enum summaryFormats {
 };
 
 static const enum summaryFormats summaryFormat = SUMMARY_HUMAN_READABLE;
+
+// Folder (relative to the feeds folder) where MinRSS keeps its own state.
+static const char stateDir[] = ".minrss";
+
+// Maintain a full-text index of saved articles for 'minrss search'.
+static const int searchIndex = 0;
+
+// Merge the search index once it is split over more segment files than this.
+static const unsigned long maxIndexSegments = 8;
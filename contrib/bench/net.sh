@@ -0,0 +1,68 @@
+#!/bin/sh
+# Compare the DRIVER_POLL and DRIVER_EPOLL transfer drivers: build MinRSS
+# with each, then fetch the same number of feeds at once from a local
+# server that answers after a delay, and print the wall and CPU time
+# spent in performRequests (net_usec and net_cpu_usec).
+#
+# Usage: contrib/bench/net.sh [feeds] [delay ms] [runs]
+# Run from the root of the source tree. Needs python3, and one file
+# descriptor per feed.
+
+set -e
+
+feeds=${1:-3000}
+delay=${2:-500}
+runs=${3:-3}
+port=${BENCH_PORT:-8799}
+
+src=$(pwd)
+bench=$(dirname "$0")
+tmp=$(mktemp -d)
+
+cleanup() {
+	[ -n "$server" ] && kill "$server" 2>/dev/null
+	rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+ulimit -n $((feeds + 256)) 2>/dev/null || true
+
+python3 "$bench/netsrv.py" "$port" "$delay" &
+server=$!
+sleep 1
+
+for driver in DRIVER_POLL DRIVER_EPOLL; do
+	build="$tmp/$driver"
+	mkdir -p "$build"
+	cp "$src"/*.c "$src"/*.h "$src"/Makefile "$build"
+	rm -f "$build/config.h"
+
+	# Replace the feed list and pick the driver.
+	awk -v feeds="$feeds" -v port="$port" -v driver="$driver" '
+		/^static const linkStruct links\[\] = \{/ {
+			print
+			for (i = 0; i < feeds; i++)
+				printf "\t{ .url = \"http://127.0.0.1:%d/%d\", .feedName = \"f%d\", .update = 0, },\n", port, i, i
+			skip = 1
+			next
+		}
+		skip && /^\};/ { skip = 0 }
+		skip { next }
+		/netDriver = / { sub(/DRIVER_[A-Z]+/, driver) }
+		/dnsCacheTime = / { sub(/= [0-9]+/, "= 0") }
+		{ print }
+	' "$src/config.def.h" > "$build/config.h"
+
+	make -s -C "$build" JSONLIBS= JSONFLAG= >/dev/null
+
+	i=1
+	while [ "$i" -le "$runs" ]; do
+		rm -rf "$tmp/run"
+		mkdir -p "$tmp/run"
+		result=$(cd "$tmp/run" && "$build/minrss" -l info 2>&1 |
+		         awk '/stat net_usec/ { wall = $4 } /stat net_cpu_usec/ { cpu = $4 }
+		              END { printf "wall %.0f ms, cpu %.0f ms", wall / 1000, cpu / 1000 }')
+		echo "$driver, $feeds feeds, run $i: $result"
+		i=$((i + 1))
+	done
+done
@@ -0,0 +1,38 @@
+#!/usr/bin/env python3
+# Local HTTP server for contrib/bench/net.sh: answers every request with
+# an empty RSS feed after a delay, so that many transfers are in progress
+# at the same time.
+#
+# Usage: netsrv.py [port] [delay ms]
+
+import http.server
+import sys
+import time
+
+port = int(sys.argv[1]) if len(sys.argv) > 1 else 8799
+delay = int(sys.argv[2]) / 1000 if len(sys.argv) > 2 else 0.5
+
+body = b'<?xml version="1.0"?><rss version="2.0"><channel><title>bench</title></channel></rss>'
+
+
+class Server(http.server.ThreadingHTTPServer):
+    request_queue_size = 8192
+    daemon_threads = True
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.0'
+
+    def do_GET(self):
+        time.sleep(delay)
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/rss+xml')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+Server(('127.0.0.1', port), Handler).serve_forever()
@@ -0,0 +1,187 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+/*
+	Benchmark of sanitize() against san(), the function it replaced in
+	MinRSS 0.4, over a file of titles, one per line. Built and run by
+	contrib/bench/sanitize.sh.
+
+	Prints the time per title, and how many titles each function turns
+	into an empty name or into the same name as another title. Also checks
+	that without nameHash, sanitize() gives the names san() gave.
+*/
+
+// Calls to each function, spread over the titles
+#define CALLS 1000000
+
+static char *
+san(char *str)
+{
+	// san() from MinRSS 0.4, unchanged.
+
+	if (!str)
+		return "";
+
+	unsigned long long int len = strlen(str);
+	unsigned long long int offset = 0;
+
+	len = len > 255 ? 255 : len;
+
+	char *dup = ecalloc(len + 1, sizeof(char));
+	memcpy(dup, str, (len + 1) * sizeof(char));
+
+	for (unsigned long long int i = 0; i < len; i++) {
+		char c = dup[i];
+
+		if ((c >= 'a' && c <= 'z') ||
+		        (c >= 'A' && c <= 'Z') ||
+		        (c >= '0' && c <= '9') ||
+		        (c == '.' && i - offset != 0) ||
+		        c == '-' || c == '_' ||
+		        c == ' ')
+			dup[i - offset] = dup[i];
+		else
+			offset++;
+	}
+
+	dup[len-offset] = '\0';
+
+	return dup;
+}
+
+static int
+cmpNames(const void *a, const void *b)
+{
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static void
+countNames(const char *label, char **names, size_t count)
+{
+	// Report empty names, and names shared by several titles.
+
+	size_t empty = 0, merged = 0;
+
+	qsort(names, count, sizeof(char *), cmpNames);
+
+	for (size_t i = 0; i < count; i++) {
+		if (!names[i][0])
+			empty++;
+		else if (i && !strcmp(names[i], names[i - 1]))
+			merged++;
+	}
+
+	printf("%-24s %zu empty names, %zu titles merged with another\n", label, empty, merged);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s titles.txt\n", argv[0]);
+		return 1;
+	}
+
+	FILE *f = fopen(argv[1], "r");
+	if (!f) {
+		fprintf(stderr, "Can not open %s.\n", argv[1]);
+		return 1;
+	}
+
+	char **titles = NULL;
+	size_t count = 0, cap = 0;
+	char *line = NULL;
+	size_t lineCap = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &lineCap, f)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (!len)
+			continue;
+
+		if (count == cap) {
+			cap = cap ? cap * 2 : 256;
+			titles = erealloc(titles, cap * sizeof(char *));
+		}
+		titles[count] = ecalloc(len + 1, sizeof(char));
+		memcpy(titles[count++], line, len + 1);
+	}
+
+	free(line);
+	fclose(f);
+
+	if (!count) {
+		fprintf(stderr, "No titles in %s.\n", argv[1]);
+		return 1;
+	}
+
+	char buf[MAX_NAME + 1];
+	// Keeps the compiler from dropping the calls
+	volatile size_t sink = 0;
+	long long start;
+
+	printf("%zu titles, %d calls each\n", count, CALLS);
+
+	start = monoNsec();
+	for (size_t i = 0; i < CALLS; i++) {
+		char *name = san(titles[i % count]);
+		sink += name[0];
+		free(name);
+	}
+	printf("%-24s %.1f ns/title\n", "san", (double) (monoNsec() - start) / CALLS);
+
+	start = monoNsec();
+	for (size_t i = 0; i < CALLS; i++)
+		sink += sanitize(buf, sizeof(buf), titles[i % count], NULL);
+	printf("%-24s %.1f ns/title\n", "sanitize", (double) (monoNsec() - start) / CALLS);
+
+	start = monoNsec();
+	for (size_t i = 0; i < CALLS; i++)
+		sink += sanitize(buf, sizeof(buf), titles[i % count], titles[i % count]);
+	printf("%-24s %.1f ns/title\n", "sanitize with nameHash", (double) (monoNsec() - start) / CALLS);
+
+	char **names = ecalloc(count, sizeof(char *));
+
+	size_t differ = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		names[i] = san(titles[i]);
+		sanitize(buf, sizeof(buf), titles[i], NULL);
+		differ += strcmp(names[i], buf) != 0;
+	}
+	countNames("san", names, count);
+	for (size_t i = 0; i < count; i++)
+		free(names[i]);
+
+	printf("%-24s %zu names differ from san\n", "sanitize", differ);
+
+	for (size_t i = 0; i < count; i++) {
+		names[i] = ecalloc(MAX_NAME + 1, sizeof(char));
+		sanitize(names[i], MAX_NAME + 1, titles[i], titles[i]);
+	}
+	countNames("sanitize with nameHash", names, count);
+	for (size_t i = 0; i < count; i++)
+		free(names[i]);
+
+	free(names);
+	for (size_t i = 0; i < count; i++)
+		free(titles[i]);
+	free(titles);
+
+	return 0;
+}
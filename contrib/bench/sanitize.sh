@@ -0,0 +1,28 @@
+#!/bin/sh
+# Compare sanitize() with san(), the file name function of MinRSS 0.4,
+# on a file of titles (one per line, contrib/bench/titles.txt by default).
+#
+# Usage: contrib/bench/sanitize.sh [titles file]
+# Run from the root of the source tree.
+#
+# titles.txt holds real article, paper and encyclopedia titles in several
+# languages and scripts. To use the titles of your own feeds instead, with
+# OUTPUT_HTML, run this in the feeds folder:
+#	sed -n 's|^<h1>\(.*\)</h1><br>$|\1|p' */*.html > titles.txt
+
+set -e
+
+src=$(pwd)
+bench=$(dirname "$0")
+titles=${1:-$bench/titles.txt}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+cp "$src/util.c" "$src/util.h" "$tmp"
+cp "$src/config.def.h" "$tmp/config.h"
+
+${CC:-cc} -O2 -std=c99 -D_POSIX_C_SOURCE=200809L -I"$tmp" \
+	$(pkg-config --cflags libxml-2.0 libcurl) \
+	-o "$tmp/sanitize" "$tmp/util.c" "$bench/sanitize.c"
+
+"$tmp/sanitize" "$titles"
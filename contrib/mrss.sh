@@ -12,6 +12,10 @@ mkdir -p "$MRSS_DIR"
 if [ -z "$MRSS_NEWDIR" ]; then
 	MRSS_NEWDIR="$MRSS_DIR/new"
 fi
+# must match stateDir in config.h
+if [ -z "$MRSS_STATEDIR" ]; then
+	MRSS_STATEDIR=".minrss"
+fi
 if [ -z "$MRSS_WATCH_LATER" ]; then
 	MRSS_WATCH_LATER="$MRSS_DIR/watch-later"
 fi
@@ -204,7 +208,7 @@ mrss_find() {
 	# a meta-feed should only have directory links
 	# if there is a file link, use the way faster approach to list files
 	if [ -f "$(realpath "$(ls | head -n 1)")" ]; then
-		find . -mindepth 1 -maxdepth 1 -or -type f -or -type l
+		find . -mindepth 1 -maxdepth 1 ! -name "$MRSS_STATEDIR" \( -type f -or -type l \)
 		return
 	fi
 
@@ -212,7 +216,8 @@ mrss_find() {
 	# this means you can make your own tag folders that link to specific feeds
 	# we don't follow file links because mrss purge only deletes links from new/
 
-	find . -mindepth 1 -maxdepth 1 -type d -or -type f -or -type l | \
+	# MinRSS's own state is not a feed
+	find . -mindepth 1 -maxdepth 1 ! -name "$MRSS_STATEDIR" \( -type d -or -type f -or -type l \) | \
 	(while read -r f; do
 		# this loop finds directories (symlink or real)
 		# regular files go through this pipeline unaffected
@@ -227,7 +232,8 @@ mrss_find() {
 	done) | \
 	(while read -r f; do
 		# this loop lists directories
-		find -H "$f" -type f -or -type l
+		# pages and enclosures saved next to articles are not articles
+		find -H "$f" \( -type f -or -type l \) ! -name '*.page.html' ! -name '*.enclosure*'
 	done)
 }
 
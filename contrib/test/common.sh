@@ -0,0 +1,64 @@
+# Shared by the scripts in contrib/test/, which source it from the root of
+# the source tree.
+#
+# build LINKS SED-SCRIPT builds MinRSS in $tmp/build, with config.def.h as
+# config.h after replacing the feed list with LINKS and applying
+# SED-SCRIPT. serve DIR PORT serves a folder over HTTP. check and fail
+# report the result of each test.
+
+set -e
+
+src=$(pwd)
+test=$(dirname "$0")
+tmp=$(mktemp -d)
+servers=
+failed=0
+
+cleanup() {
+	[ -n "$servers" ] && kill $servers 2>/dev/null
+	rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+build() {
+	mkdir -p "$tmp/build"
+	cp "$src"/*.c "$src"/*.h "$src"/Makefile "$tmp/build"
+	rm -f "$tmp/build/config.h"
+
+	awk -v links="$1" '
+		/^static const linkStruct links\[\] = \{/ {
+			print
+			print links
+			skip = 1
+			next
+		}
+		skip && /^\};/ { skip = 0 }
+		skip { next }
+		{ print }
+	' "$src/config.def.h" | sed -e "$2" > "$tmp/build/config.h"
+
+	make -s -C "$tmp/build" JSONLIBS= JSONFLAG= >/dev/null
+	minrss="$tmp/build/minrss"
+}
+
+serve() {
+	python3 -m http.server "$2" --bind 127.0.0.1 --directory "$1" >/dev/null 2>&1 &
+	servers="$servers $!"
+	sleep 1
+}
+
+check() {
+	# check DESCRIPTION COMMAND...
+	desc=$1
+	shift
+	if "$@"; then
+		echo "ok   $desc"
+	else
+		echo "FAIL $desc"
+		failed=1
+	fi
+}
+
+inode() {
+	ls -i "$1" | awk '{ print $1 }'
+}
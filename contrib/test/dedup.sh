@@ -0,0 +1,52 @@
+#!/bin/sh
+# Check that dedupArticles only shares an article between feeds when its
+# link, title and contents are the same.
+#
+# Usage: contrib/test/dedup.sh
+# Run from the root of the source tree. Needs python3.
+
+. "$(dirname "$0")/common.sh"
+
+port=${TEST_PORT:-8797}
+url="http://127.0.0.1:$port"
+
+build "
+	{ .url = \"$url/a.rss\", .feedName = \"a\", .update = 0, },
+	{ .url = \"$url/b.rss\", .feedName = \"b\", .update = 0, },
+" 's/^static const int dedupArticles = 0;/static const int dedupArticles = 1;/'
+
+mkdir -p "$tmp/www" "$tmp/run"
+
+# Both feeds have the same story, with a summary in one and the full text
+# in the other, and the same notice.
+for feed in a b; do
+	if [ "$feed" = a ]; then
+		text="Summary."
+	else
+		text="The full text of the story."
+	fi
+
+	cat > "$tmp/www/$feed.rss" <<-FEED
+	<?xml version="1.0"?>
+	<rss version="2.0"><channel><title>$feed</title>
+	<item><title>Story</title><link>https://example.com/story</link><description>$text</description></item>
+	<item><title>Notice</title><link>https://example.com/notice</link><description>Same in both.</description></item>
+	</channel></rss>
+	FEED
+done
+
+serve "$tmp/www" "$port"
+
+cd "$tmp/run"
+"$minrss" >/dev/null 2>&1
+
+check "same link, different contents are kept apart" \
+	[ "$(inode "a/Story.html")" != "$(inode "b/Story.html")" ]
+check "feed a keeps its summary" \
+	grep -q "Summary." "a/Story.html"
+check "feed b keeps its full text" \
+	grep -q "full text" "b/Story.html"
+check "same link and contents are shared" \
+	[ "$(inode "a/Notice.html")" = "$(inode "b/Notice.html")" ]
+
+exit $failed
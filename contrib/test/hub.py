@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+# Stand-in WebSub hub for contrib/test/websub.sh, which also serves the
+# test feeds.
+#
+# Usage: hub.py port folder log
+#
+# GET /feeds/[file]     serves [folder]/[file]
+# POST /[hub]           takes a subscription request for the hub of that
+#                       name, answers 202, then verifies the intent with
+#                       the callback
+# GET /publish?hub=/[hub]&file=[file]
+#                       pushes [folder]/[file] to the subscribers of the
+#                       hub, and answers with the status of the last push
+#
+# Each verification and push is appended to the log as a line.
+
+import http.server
+import os
+import sys
+import threading
+import time
+import urllib.parse
+import urllib.request
+
+port, folder, logPath = int(sys.argv[1]), sys.argv[2], sys.argv[3]
+subs = {}
+lock = threading.Lock()
+
+
+def log(line):
+    with lock, open(logPath, 'a') as f:
+        f.write(line + '\n')
+
+
+def request(url, data=None):
+    try:
+        with urllib.request.urlopen(url, data, timeout=5) as res:
+            return res.status, res.read().decode()
+    except urllib.error.HTTPError as e:
+        return e.code, ''
+    except OSError:
+        return 0, ''
+
+
+def verify(hub, mode, topic, callback, lease):
+    time.sleep(0.2)
+    query = urllib.parse.urlencode({
+        'hub.mode': mode,
+        'hub.topic': topic,
+        'hub.challenge': 'challenge-123',
+        'hub.lease_seconds': lease,
+    })
+    status, body = request(callback + '?' + query)
+
+    if status != 200 or body != 'challenge-123':
+        log('rejected %s %s %s' % (hub, mode, topic))
+        return
+
+    with lock:
+        if mode == 'subscribe':
+            subs[(hub, callback)] = topic
+        else:
+            subs.pop((hub, callback), None)
+    log('verified %s %s %s' % (hub, mode, topic))
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    def answer(self, status, body=b''):
+        self.send_response(status)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        url = urllib.parse.urlparse(self.path)
+
+        if url.path.startswith('/feeds/'):
+            path = os.path.join(folder, os.path.basename(url.path))
+            if not os.path.isfile(path):
+                return self.answer(404)
+            with open(path, 'rb') as f:
+                return self.answer(200, f.read())
+
+        if url.path != '/publish':
+            return self.answer(404)
+
+        query = urllib.parse.parse_qs(url.query)
+        hub, name = query['hub'][0], query['file'][0]
+        with open(os.path.join(folder, name), 'rb') as f:
+            data = f.read()
+
+        with lock:
+            callbacks = [c for (h, c) in subs if h == hub]
+
+        status = 404
+        for callback in callbacks:
+            status, _ = request(callback, data)
+            log('pushed %s %d' % (hub, status))
+
+        self.answer(200, str(status).encode())
+
+    def do_POST(self):
+        length = int(self.headers.get('Content-Length', 0))
+        form = urllib.parse.parse_qs(self.rfile.read(length).decode())
+        args = (self.path, form['hub.mode'][0], form['hub.topic'][0],
+                form['hub.callback'][0], form.get('hub.lease_seconds', [''])[0])
+
+        self.answer(202)
+        threading.Thread(target=verify, args=args, daemon=True).start()
+
+    def log_message(self, *args):
+        pass
+
+
+http.server.ThreadingHTTPServer(('127.0.0.1', port), Handler).serve_forever()
@@ -0,0 +1,90 @@
+#!/bin/sh
+# Check 'minrss serve' against a stand-in WebSub hub: the subscription is
+# verified, pushed articles are saved, moving the feed to another hub
+# unsubscribes from the former one, and SIGTERM stops MinRSS cleanly.
+# Also checks that WebSub is refused with --shard.
+#
+# Usage: contrib/test/websub.sh
+# Run from the root of the source tree. Needs python3. Takes about 20 s.
+
+. "$(dirname "$0")/common.sh"
+
+hubPort=${TEST_PORT:-8795}
+callbackPort=$((hubPort + 1))
+hub="http://127.0.0.1:$hubPort"
+
+build "
+	{ .url = \"$hub/feeds/feed.rss\", .feedName = \"feed\", .update = 0, },
+" "
+	s|^static const long serveInterval = .*|static const long serveInterval = 1;|
+	s|^static const char callbackUrl\[\] = .*|static const char callbackUrl[] = \"http://127.0.0.1:$callbackPort/cb/\";|
+	s|^static const char listenAddr\[\] = .*|static const char listenAddr[] = \"127.0.0.1\";|
+	s|^static const char listenPort\[\] = .*|static const char listenPort[] = \"$callbackPort\";|
+	s|^static const long leaseSeconds = .*|static const long leaseSeconds = 20;|
+"
+
+mkdir -p "$tmp/www" "$tmp/run"
+log="$tmp/hub.log"
+touch "$log"
+
+# feed [hub] [title] writes a feed naming the hub, with one article.
+feed() {
+	cat <<-FEED
+	<?xml version="1.0"?>
+	<rss version="2.0" xmlns:atom="http://www.w3.org/2005/Atom"><channel><title>feed</title>
+	<atom:link rel="hub" href="$hub/$1"/>
+	<atom:link rel="self" href="$hub/feeds/feed.rss"/>
+	<item><title>$2</title><link>https://example.com/$2</link></item>
+	</channel></rss>
+	FEED
+}
+
+# waitFor PATTERN waits up to 30 s for a line of the hub's log.
+waitFor() {
+	i=0
+	while ! grep -q "$1" "$log" && [ $i -lt 300 ]; do
+		sleep 0.1
+		i=$((i + 1))
+	done
+	grep -q "$1" "$log"
+}
+
+feed hub1 Polled > "$tmp/www/feed.rss"
+feed hub1 Pushed > "$tmp/www/push.rss"
+
+python3 "$test/hub.py" "$hubPort" "$tmp/www" "$log" &
+servers=$!
+sleep 1
+
+cd "$tmp/run"
+"$minrss" serve >"$tmp/minrss.log" 2>&1 &
+pid=$!
+
+check "the subscription is verified" waitFor "verified /hub1 subscribe"
+check "the polled article is saved" [ -f "feed/Polled.html" ]
+
+python3 -c "import urllib.request; urllib.request.urlopen('$hub/publish?hub=/hub1&file=push.rss').read()"
+sleep 0.5
+check "the push is accepted" grep -q "pushed /hub1 202" "$log"
+check "the pushed article is saved" [ -f "feed/Pushed.html" ]
+
+# Polled again in the last tenth of the lease
+feed hub2 Moved > "$tmp/www/feed.rss"
+check "the former hub is unsubscribed" waitFor "verified /hub1 unsubscribe"
+check "the new hub is subscribed" waitFor "verified /hub2 subscribe"
+
+kill -TERM $pid
+status=0
+wait $pid || status=$?
+check "SIGTERM stops serve" [ $status -eq 143 ]
+
+check "--shard is refused with WebSub" sh -c "! '$minrss' --shard 0/2 serve >/dev/null 2>&1"
+
+if [ $failed -ne 0 ]; then
+	echo "MinRSS log:"
+	cat "$tmp/minrss.log"
+	echo "Hub log:"
+	cat "$log"
+fi
+
+exit $failed
@@ -0,0 +1,407 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "util.h"
+#include "net.h"
+#include "stats.h"
+#include "dns.h"
+
+/*
+	Cache of resolved addresses kept between runs in .minrss/dns, as
+	"[host] [port] [address] [expiry] [lookup usec]" lines.
+
+	Cached addresses are handed to curl with CURLOPT_RESOLVE, so that the
+	first request to each host skips name resolution. After each transfer,
+	the address curl connected to is recorded. libcurl does not report the
+	TTL of DNS records, so addresses are kept for dnsCacheTime seconds.
+
+	The hosts of feeds that are due soon can also be resolved ahead of
+	time with getaddrinfo(), which does not connect to them.
+*/
+
+#define MAX_HOST 255
+#define MAX_ADDR 64
+
+typedef struct {
+	char *host;
+	long port;
+	char addr[MAX_ADDR];
+	time_t expires;
+	// Time taken by the last real lookup of the host
+	long long lookupUsec;
+
+	// "+host:port:addr" rule for CURLOPT_RESOLVE
+	struct curl_slist *resolve;
+	// Set once the cached address was given to a request
+	int applied;
+	// Set once a transfer this run resolved the host or rejected the address
+	int recorded;
+	// Set once prefetchDns() looked the host up
+	int prefetched;
+} dnsStruct;
+
+// Open addressing hash table of host and port pairs
+static dnsStruct *entries;
+static size_t entryCount;
+static size_t entryCap;
+
+// Rules given to curl, which must be kept until the transfers are done
+static struct curl_slist **lists;
+static size_t listCount;
+
+static size_t
+hashEntry(const char *host, long port)
+{
+	return hash64(host, strlen(host)) ^ ((uint64_t) port * 0x9e3779b97f4a7c15ULL);
+}
+
+static void
+growEntries()
+{
+	size_t oldCap = entryCap;
+	dnsStruct *old = entries;
+
+	entryCap = oldCap ? oldCap * 2 : 256;
+	entries = ecalloc(entryCap, sizeof(dnsStruct));
+
+	size_t mask = entryCap - 1;
+
+	for (size_t i = 0; i < oldCap; i++) {
+		if (!old[i].host)
+			continue;
+
+		size_t j = hashEntry(old[i].host, old[i].port) & mask;
+		while (entries[j].host)
+			j = (j + 1) & mask;
+		entries[j] = old[i];
+	}
+
+	free(old);
+}
+
+static dnsStruct *
+findEntry(const char *host, long port, int create)
+{
+	// Returns the entry of a host, or NULL if it is missing and create
+	// is not set.
+
+	if (create && (entryCount + 1) * 2 > entryCap)
+		growEntries();
+
+	if (!entryCap)
+		return NULL;
+
+	size_t mask = entryCap - 1;
+	size_t i = hashEntry(host, port) & mask;
+
+	while (entries[i].host) {
+		if (entries[i].port == port && !strcmp(entries[i].host, host))
+			return &entries[i];
+		i = (i + 1) & mask;
+	}
+
+	if (!create)
+		return NULL;
+
+	size_t len = strlen(host) + 1;
+	entries[i].host = ecalloc(len, sizeof(char));
+	memcpy(entries[i].host, host, len);
+	entries[i].port = port;
+	entryCount++;
+
+	return &entries[i];
+}
+
+static dnsStruct *
+urlEntry(const char *url, int create)
+{
+	long port;
+	char *host = urlHost(url, &port);
+
+	// Addresses do not need resolving
+	if (!host || host[0] == '[' || strlen(host) > MAX_HOST) {
+		free(host);
+		return NULL;
+	}
+
+	dnsStruct *entry = findEntry(host, port, create);
+	free(host);
+
+	return entry;
+}
+
+static struct curl_slist *
+makeRule(const dnsStruct *entry, char prefix)
+{
+	// Build a CURLOPT_RESOLVE rule, adding (+) or removing (-) the
+	// entry's address in curl's cache.
+
+	char rule[MAX_HOST + MAX_ADDR + 32];
+
+	if (prefix == '-')
+		snprintf(rule, sizeof(rule), "-%s:%ld", entry->host, entry->port);
+	else if (strchr(entry->addr, ':'))
+		snprintf(rule, sizeof(rule), "+%s:%ld:[%s]", entry->host, entry->port, entry->addr);
+	else
+		snprintf(rule, sizeof(rule), "+%s:%ld:%s", entry->host, entry->port, entry->addr);
+
+	lists = erealloc(lists, (listCount + 1) * sizeof(struct curl_slist *));
+	lists[listCount] = curl_slist_append(NULL, rule);
+
+	return lists[listCount++];
+}
+
+static void
+readEntries(const char *path)
+{
+	// Add the unexpired entries of a cache file to the table. Entries
+	// recorded during this run take precedence, otherwise the one that
+	// expires last is kept.
+
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return;
+
+	char host[MAX_HOST + 1];
+	char addr[MAX_ADDR];
+	long port;
+	long long expires, lookupUsec;
+	time_t now = time(NULL);
+
+	while (fscanf(f, "%255s %ld %63s %lld %lld", host, &port, addr, &expires, &lookupUsec) == 5) {
+		if (expires <= now)
+			continue;
+
+		dnsStruct *entry = findEntry(host, port, 1);
+
+		if (entry->recorded || expires <= entry->expires)
+			continue;
+
+		strcpy(entry->addr, addr);
+		entry->expires = expires;
+		entry->lookupUsec = lookupUsec;
+	}
+
+	fclose(f);
+}
+
+void
+loadDns()
+{
+	if (!dnsCacheTime)
+		return;
+
+	char *path = joinPath(stateDir, "dns");
+	readEntries(path);
+	free(path);
+}
+
+void
+applyDns(CURL *requestHandle, const char *url)
+{
+	// Give curl the cached address of the URL's host, if there is one.
+
+	if (!entryCount)
+		return;
+
+	dnsStruct *entry = urlEntry(url, 0);
+
+	if (!entry || !entry->addr[0] || entry->expires <= time(NULL))
+		return;
+
+	if (!entry->resolve)
+		entry->resolve = makeRule(entry, '+');
+
+	curl_easy_setopt(requestHandle, CURLOPT_RESOLVE, entry->resolve);
+
+	if (!entry->applied) {
+		entry->applied = 1;
+		statAdd(STAT_DNS_HITS, 1);
+		statAdd(STAT_DNS_SAVED_USEC, entry->lookupUsec);
+	}
+}
+
+void
+recordDns(CURL *requestHandle, CURLcode result)
+{
+	// Remember the address a finished transfer connected to.
+
+	if (!dnsCacheTime)
+		return;
+
+	char *url = NULL, *ip = NULL;
+	curl_off_t lookupUsec = 0, connectUsec = 0;
+
+	curl_easy_getinfo(requestHandle, CURLINFO_EFFECTIVE_URL, &url);
+	curl_easy_getinfo(requestHandle, CURLINFO_PRIMARY_IP, &ip);
+	curl_easy_getinfo(requestHandle, CURLINFO_NAMELOOKUP_TIME_T, &lookupUsec);
+	curl_easy_getinfo(requestHandle, CURLINFO_CONNECT_TIME_T, &connectUsec);
+
+#if LIBCURL_VERSION_NUM >= 0x080700
+	// The address would be the proxy's
+	long proxy = 0;
+	curl_easy_getinfo(requestHandle, CURLINFO_USED_PROXY, &proxy);
+	if (proxy)
+		return;
+#endif // LIBCURL_VERSION_NUM
+
+	dnsStruct *entry = url ? urlEntry(url, 1) : NULL;
+
+	if (!entry)
+		return;
+
+	if (result != CURLE_OK && !connectUsec) {
+		// The cached address may be stale. Drop it here and in curl's
+		// cache, in case the transfer is retried.
+		if (entry->applied && entry->expires) {
+			logMsg(LOG_VERBOSE, "Could not connect to the cached address of %s, resolving it again.\n",
+			       entry->host);
+			entry->addr[0] = '\0';
+			entry->expires = 0;
+			entry->recorded = 1;
+			curl_easy_setopt(requestHandle, CURLOPT_RESOLVE, makeRule(entry, '-'));
+		}
+		return;
+	}
+
+	if (!ip || !ip[0] || strlen(ip) >= MAX_ADDR || !strcmp(ip, entry->host))
+		return;
+
+	// Later transfers to the host may have waited on the same lookup.
+	if (!entry->applied && !entry->recorded) {
+		statAdd(STAT_DNS_LOOKUPS, 1);
+		statAdd(STAT_DNS_LOOKUP_USEC, lookupUsec);
+		entry->lookupUsec = lookupUsec;
+	} else if (!entry->applied && lookupUsec > entry->lookupUsec) {
+		entry->lookupUsec = lookupUsec;
+	}
+
+	// Requests made from now on get the new address.
+	if (strcmp(entry->addr, ip))
+		entry->resolve = NULL;
+
+	strcpy(entry->addr, ip);
+	entry->expires = time(NULL) + dnsCacheTime;
+	entry->recorded = 1;
+}
+
+void
+prefetchDns(const char *url, time_t due)
+{
+	// Resolve the host of a feed that is due before dnsPrefetchTime
+	// seconds from now, unless its cached address lasts until then.
+	// Each lookup blocks, which is why this is off by default.
+
+	if (!dnsCacheTime || !dnsPrefetchTime || due - time(NULL) > dnsPrefetchTime)
+		return;
+
+	dnsStruct *entry = urlEntry(url, 1);
+
+	if (!entry || entry->prefetched || entry->expires > due)
+		return;
+
+	entry->prefetched = 1;
+
+	logMsg(LOG_VERBOSE, "Resolving the host of %s ahead of time.\n", url);
+	statAdd(STAT_DNS_PREFETCHES, 1);
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV;
+
+	char port[32];
+	snprintf(port, sizeof(port), "%ld", entry->port);
+
+	long long start = monoNsec();
+
+	if (getaddrinfo(entry->host, port, &hints, &res)) {
+		logMsg(LOG_VERBOSE, "Could not resolve %s.\n", entry->host);
+		return;
+	}
+
+	char addr[MAX_ADDR];
+
+	if (!getnameinfo(res->ai_addr, res->ai_addrlen, addr, sizeof(addr), NULL, 0, NI_NUMERICHOST)) {
+		strcpy(entry->addr, addr);
+		entry->expires = time(NULL) + dnsCacheTime;
+		entry->lookupUsec = (monoNsec() - start) / 1000;
+		entry->recorded = 1;
+	}
+
+	freeaddrinfo(res);
+}
+
+int
+saveDns()
+{
+	// Write the cache, merged with what other MinRSS processes wrote
+	// meanwhile, then free it. Call after the last transfer is done.
+
+	int err = 0;
+
+	if (dnsCacheTime && entryCount && !(err = makeDir(stateDir))) {
+		char *path = joinPath(stateDir, "dns");
+		char *tmpPath = ecalloc(strlen(path) + 32, sizeof(char));
+		sprintf(tmpPath, "%s.tmp-%ld", path, (long) getpid());
+
+		readEntries(path);
+
+		FILE *f = fopen(tmpPath, "w");
+		time_t now = time(NULL);
+
+		if (f) {
+			for (size_t i = 0; i < entryCap; i++) {
+				dnsStruct *entry = &entries[i];
+				if (entry->host && entry->addr[0] && entry->expires > now)
+					fprintf(f, "%s %ld %s %lld %lld\n", entry->host, entry->port, entry->addr,
+					        (long long) entry->expires, entry->lookupUsec);
+			}
+			err = fclose(f) || rename(tmpPath, path);
+		} else {
+			err = 1;
+		}
+
+		if (err) {
+			logMsg(LOG_ERROR, "Could not write %s.\n", path);
+			remove(tmpPath);
+		}
+
+		free(tmpPath);
+		free(path);
+	}
+
+	for (size_t i = 0; i < entryCap; i++)
+		free(entries[i].host);
+	free(entries);
+	entries = NULL;
+	entryCount = entryCap = 0;
+
+	for (size_t i = 0; i < listCount; i++)
+		curl_slist_free_all(lists[i]);
+	free(lists);
+	lists = NULL;
+	listCount = 0;
+
+	return err;
+}
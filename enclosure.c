@@ -0,0 +1,618 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "util.h"
+#include "net.h"
+#include "stats.h"
+#include "enclosure.h"
+
+/*
+	Downloads enclosures (podcast episodes, videos...) of new articles,
+	saved next to them as [article].enclosure[.ext]. Files are streamed
+	to a .part file, which is resumed with a Range request on the next
+	run if the download is interrupted.
+
+	Large files of known size can be fetched as several ranges in
+	parallel, once a HEAD request confirms the length given by the feed.
+	If one of them fails, the .part file is cut to the contiguous data at
+	its start, so the next run resumes from there with a single transfer.
+
+	Unfinished downloads are listed in .minrss/feeds/[feed].enclosures,
+	one "[length] [url] [file name]" line each, so that they are resumed
+	even when the feed is not parsed again, for instance because it did
+	not change.
+*/
+
+typedef struct {
+	char *url;
+	// Feed folder, and the file name in it without .part
+	char *folder;
+	char *name;
+	char *path;
+	char *partPath;
+	// Length given by the feed, 0 if unknown
+	long long size;
+	FILE *file;
+	int resumed;
+
+	// Checks the size before the file is split
+	outputStruct head;
+
+	outputStruct *outputs;
+	int segments;
+	curl_off_t segmentLen;
+	int failed;
+} enclosureStruct;
+
+static enclosureStruct *enclosures;
+static size_t enclosureCount;
+static size_t enclosureCap;
+
+// Feeds whose list of unfinished downloads was read this run
+static char **listed;
+static size_t listedCount;
+
+static const struct {
+	const char *type;
+	const char *ext;
+} extTable[] = {
+	{ "audio/mpeg", ".mp3" },
+	{ "audio/mp4", ".m4a" },
+	{ "audio/x-m4a", ".m4a" },
+	{ "audio/aac", ".aac" },
+	{ "audio/ogg", ".ogg" },
+	{ "audio/opus", ".opus" },
+	{ "audio/flac", ".flac" },
+	{ "video/mp4", ".mp4" },
+	{ "video/webm", ".webm" },
+	{ "video/x-matroska", ".mkv" },
+	{ "image/jpeg", ".jpg" },
+	{ "image/png", ".png" },
+	{ "application/pdf", ".pdf" },
+};
+
+static const char *
+typeExt(const char *type)
+{
+	// File extension for a MIME type, ignoring parameters.
+
+	if (!type)
+		return "";
+
+	size_t len = strcspn(type, "; ");
+
+	for (size_t i = 0; i < LEN(extTable); i++) {
+		if (strlen(extTable[i].type) == len && !strncmp(extTable[i].type, type, len))
+			return extTable[i].ext;
+	}
+
+	return "";
+}
+
+static int
+typeAllowed(const char *type)
+{
+	for (size_t i = 0; i < LEN(enclosureTypes); i++) {
+		const char *prefix = enclosureTypes[i];
+		if (!strncmp(type ? type : "", prefix, strlen(prefix)))
+			return 1;
+	}
+
+	return 0;
+}
+
+static char *
+copyStr(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *copy = ecalloc(len, sizeof(char));
+	memcpy(copy, str, len);
+
+	return copy;
+}
+
+static char *
+enclosurePath(const char *folder, const char *basename, const char *ext, const char *suffix)
+{
+	size_t len = strlen(basename) + strlen(".enclosure") + strlen(ext) + strlen(suffix);
+	char *name = ecalloc(len + 1, sizeof(char));
+
+	sprintf(name, "%s.enclosure%s%s", basename, ext, suffix);
+	char *path = joinPath(folder, name);
+	free(name);
+
+	return path;
+}
+
+static char *
+listPath(const char *folder)
+{
+	char *feedsDir = joinPath(stateDir, "feeds");
+	char *name = ecalloc(strlen(folder) + 12, sizeof(char));
+
+	sprintf(name, "%s.enclosures", folder);
+	char *path = joinPath(feedsDir, name);
+
+	free(name);
+	free(feedsDir);
+
+	return path;
+}
+
+static void
+addEnclosure(const char *url, long long size, const char *folder, const char *name, int isNew)
+{
+	// Queue a download unless it is finished or already queued. Old
+	// articles are only queued to resume an interrupted download.
+
+	char *path = joinPath(folder, name);
+	char *partPath = ecalloc(strlen(path) + 6, sizeof(char));
+	struct stat st;
+
+	sprintf(partPath, "%s.part", path);
+
+	int skip = !stat(path, &st) || (!isNew && stat(partPath, &st));
+
+	for (size_t i = 0; !skip && i < enclosureCount; i++)
+		skip = !strcmp(enclosures[i].path, path);
+
+	if (skip) {
+		free(path);
+		free(partPath);
+		return;
+	}
+
+	if (enclosureCount == enclosureCap) {
+		enclosureCap = enclosureCap ? enclosureCap * 2 : 16;
+		enclosures = erealloc(enclosures, enclosureCap * sizeof(enclosureStruct));
+	}
+
+	enclosureStruct *enc = &enclosures[enclosureCount++];
+	memset(enc, 0, sizeof(enclosureStruct));
+
+	enc->url = copyStr(url);
+	enc->folder = copyStr(folder);
+	enc->name = copyStr(name);
+	enc->path = path;
+	enc->partPath = partPath;
+	enc->size = size > 0 ? size : 0;
+}
+
+void
+resumeEnclosures(const char *folder)
+{
+	// Queue the unfinished downloads of a feed, once per run.
+
+	if (!downloadEnclosures)
+		return;
+
+	for (size_t i = 0; i < listedCount; i++) {
+		if (!strcmp(listed[i], folder))
+			return;
+	}
+
+	listed = erealloc(listed, (listedCount + 1) * sizeof(char *));
+	listed[listedCount++] = copyStr(folder);
+
+	char *path = listPath(folder);
+	FILE *f = fopen(path, "r");
+	free(path);
+
+	if (!f)
+		return;
+
+	char *line = NULL;
+	size_t lineCap = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &lineCap, f)) > 0) {
+		long long size;
+		int urlStart;
+
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (sscanf(line, "%lld %n", &size, &urlStart) != 1)
+			continue;
+
+		char *url = line + urlStart;
+		char *name = strchr(url, ' ');
+
+		if (!name || !name[1])
+			continue;
+		*name++ = '\0';
+
+		// Downloads whose .part file is gone were finished elsewhere, or
+		// evicted with their article.
+		addEnclosure(url, size, folder, name, 0);
+	}
+
+	free(line);
+	fclose(f);
+}
+
+void
+queueEnclosure(const char *url, const char *type, long long size,
+               const char *folder, const char *basename, int isNew)
+{
+	// Queue an article's enclosure if enclosure downloads are enabled and
+	// its type is wanted.
+
+	if (!downloadEnclosures || !url || !url[0] || !typeAllowed(type))
+		return;
+
+	// The list is rewritten after the downloads, so it must be read first.
+	resumeEnclosures(folder);
+
+	const char *ext = typeExt(type);
+	char *name = ecalloc(strlen(basename) + strlen(".enclosure") + strlen(ext) + 1, sizeof(char));
+
+	sprintf(name, "%s.enclosure%s", basename, ext);
+	addEnclosure(url, size, folder, name, isNew);
+
+	free(name);
+}
+
+static void
+saveLists()
+{
+	// Rewrite the lists of unfinished downloads of the feeds read this
+	// run, then forget them.
+
+	if (!listedCount)
+		return;
+
+	char *feedsDir = joinPath(stateDir, "feeds");
+	int err = makeDir(stateDir) || makeDir(feedsDir);
+	free(feedsDir);
+
+	for (size_t i = 0; i < listedCount; i++) {
+		char *path = listPath(listed[i]);
+		char *tmpPath = ecalloc(strlen(path) + 32, sizeof(char));
+		sprintf(tmpPath, "%s.tmp-%ld", path, (long) getpid());
+
+		FILE *f = err ? NULL : fopen(tmpPath, "w");
+		size_t count = 0;
+
+		for (size_t j = 0; f && j < enclosureCount; j++) {
+			enclosureStruct *enc = &enclosures[j];
+
+			if (enc->failed && !strcmp(enc->folder, listed[i])) {
+				fprintf(f, "%lld %s %s\n", enc->size, enc->url, enc->name);
+				count++;
+			}
+		}
+
+		if (!f) {
+			logMsg(LOG_ERROR, "Could not write %s.\n", path);
+		} else if (fclose(f) || !count || rename(tmpPath, path)) {
+			remove(tmpPath);
+			if (!count)
+				remove(path);
+		}
+
+		free(tmpPath);
+		free(path);
+		free(listed[i]);
+	}
+
+	free(listed);
+	listed = NULL;
+	listedCount = 0;
+}
+
+void
+removeEnclosure(const char *folder, const char *basename)
+{
+	// Remove an article's enclosure, whatever its type, finished or not.
+
+	for (size_t i = 0; i <= LEN(extTable); i++) {
+		const char *ext = i < LEN(extTable) ? extTable[i].ext : "";
+		char *path = enclosurePath(folder, basename, ext, "");
+		char *partPath = enclosurePath(folder, basename, ext, ".part");
+
+		remove(path);
+		remove(partPath);
+
+		free(path);
+		free(partPath);
+	}
+}
+
+int
+isEnclosure(const char *name)
+{
+	// Returns 1 if name is that of an enclosure file, finished or not.
+
+	size_t len = strlen(name);
+	size_t partLen = strlen(".part");
+
+	if (len > partLen && !strcmp(name + len - partLen, ".part"))
+		len -= partLen;
+
+	for (size_t i = 0; i <= LEN(extTable); i++) {
+		char suffix[32];
+		size_t suffixLen = snprintf(suffix, sizeof(suffix), ".enclosure%s",
+		                            i < LEN(extTable) ? extTable[i].ext : "");
+
+		if (len > suffixLen && !strncmp(name + len - suffixLen, suffix, suffixLen))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void
+enclosureDone(char *url, long responseCode)
+{
+	logMsg(LOG_VERBOSE, "Finished enclosure transfer %s (HTTP %ld)\n", url, responseCode);
+}
+
+static void
+checkSizes()
+{
+	// Decide how many ranges each file is fetched as. A length given by
+	// the feed that is too small would cut a split file short, so large
+	// files are only split if a HEAD request confirms their size.
+
+	size_t checks = 0;
+	struct stat st;
+
+	for (size_t i = 0; i < enclosureCount; i++) {
+		enclosureStruct *enc = &enclosures[i];
+		enc->segments = 1;
+
+		// Partial downloads are resumed with a single transfer.
+		if (enclosureSegments < 2 || enc->size < enclosureSegmentSize || !stat(enc->partPath, &st))
+			continue;
+
+		if (!createHead(enc->url, &enc->head))
+			checks++;
+	}
+
+	if (!checks)
+		return;
+
+	performRequests(enclosureDone);
+
+	for (size_t i = 0; i < enclosureCount; i++) {
+		enclosureStruct *enc = &enclosures[i];
+
+		if (!enc->head.attempts)
+			continue;
+
+		if (!requestFailed(&enc->head) && enc->head.fileSize == enc->size)
+			enc->segments = enclosureSegments;
+		else
+			logMsg(LOG_VERBOSE, "Could not confirm that %s is %lld bytes long, not splitting it.\n",
+			       enc->url, enc->size);
+
+		free(enc->head.buffer);
+	}
+}
+
+static int
+startEnclosure(enclosureStruct *enc, curl_off_t maxSpeed)
+{
+	struct stat st;
+
+	if (!stat(enc->partPath, &st)) {
+		enc->file = fopen(enc->partPath, "ab");
+		enc->resumed = 1;
+	} else {
+		enc->file = fopen(enc->partPath, "wb");
+	}
+
+	if (!enc->file) {
+		logMsg(LOG_ERROR, "Could not open %s.\n", enc->partPath);
+		return 1;
+	}
+
+	if (enc->resumed || enc->segments < 2) {
+		enc->segments = 1;
+		enc->outputs = ecalloc(1, sizeof(outputStruct));
+		enc->outputs[0].file = enc->file;
+		enc->outputs[0].offset = enc->resumed ? st.st_size : 0;
+
+		if (enc->resumed)
+			logMsg(LOG_VERBOSE, "Resuming %s at %lld bytes\n", enc->url, (long long) st.st_size);
+
+		return createDownload(enc->url, &enc->outputs[0], NULL, maxSpeed);
+	}
+
+	enc->segmentLen = (enc->size + enc->segments - 1) / enc->segments;
+	enc->outputs = ecalloc(enc->segments, sizeof(outputStruct));
+
+	for (int i = 0; i < enc->segments; i++) {
+		outputStruct *output = &enc->outputs[i];
+		curl_off_t start = i * enc->segmentLen;
+		curl_off_t end = start + enc->segmentLen - 1;
+		if (end >= enc->size)
+			end = enc->size - 1;
+
+		char range[64];
+		snprintf(range, sizeof(range), "%lld-%lld", (long long) start, (long long) end);
+
+		output->file = enc->file;
+		output->offset = start;
+		output->positioned = 1;
+
+		if (createDownload(enc->url, output, range, maxSpeed))
+			return 1;
+
+		// A server ignoring the range sends the whole file
+		output->maxSize = end - start + 1;
+	}
+
+	return 0;
+}
+
+static int
+finishSegments(enclosureStruct *enc)
+{
+	// Returns 0 if every segment is complete. Otherwise, cuts the file
+	// to the data contiguous from its start.
+
+	curl_off_t valid = 0;
+
+	// The file changed since its size was checked: start over.
+	for (int i = 0; i < enc->segments; i++) {
+		if (enc->outputs[i].responseCode == 206 && enc->outputs[i].fileSize != enc->size) {
+			logMsg(LOG_VERBOSE, "The size of %s changed during the download.\n", enc->url);
+			goto cut;
+		}
+	}
+
+	for (int i = 0; i < enc->segments; i++) {
+		outputStruct *output = &enc->outputs[i];
+		curl_off_t expected = enc->segmentLen;
+		if (output->offset + expected > enc->size)
+			expected = enc->size - output->offset;
+
+		// A 200 response is only usable for the first segment.
+		int usable = output->responseCode == 206 ||
+		             (!i && output->responseCode == 200);
+
+		if (!usable)
+			break;
+
+		valid = output->offset + output->size;
+
+		if (requestFailed(output) || (curl_off_t) output->size != expected)
+			break;
+		if (i == enc->segments - 1)
+			return 0;
+	}
+
+cut:
+	fflush(enc->file);
+	if (ftruncate(fileno(enc->file), valid))
+		logMsg(LOG_ERROR, "Could not truncate %s.\n", enc->partPath);
+
+	return 1;
+}
+
+static int
+finishSingle(enclosureStruct *enc)
+{
+	// Returns 0 if the download is complete.
+
+	outputStruct *output = &enc->outputs[0];
+
+	// Asked to resume past the end: the file was already complete.
+	if (enc->resumed && output->responseCode == 416 && enc->size &&
+	        output->offset == enc->size)
+		return 0;
+
+	if (!requestFailed(output))
+		return 0;
+
+	// The server can not resume, start over next time.
+	if (output->result == CURLE_RANGE_ERROR || output->responseCode == 416) {
+		fflush(enc->file);
+		if (ftruncate(fileno(enc->file), 0))
+			logMsg(LOG_ERROR, "Could not truncate %s.\n", enc->partPath);
+	}
+
+	return 1;
+}
+
+int
+fetchEnclosures()
+{
+	// Download the queued enclosures. Returns the number that failed.
+
+	if (!enclosureCount) {
+		saveLists();
+		return 0;
+	}
+
+	int failed = 0;
+	long long start = monoNsec();
+
+	limitConnections(enclosureConnections, enclosureHostConnections);
+
+	checkSizes();
+
+	// Share the bandwidth cap between all transfers
+	size_t transfers = 0;
+	for (size_t i = 0; i < enclosureCount; i++)
+		transfers += enclosures[i].segments;
+
+	curl_off_t maxSpeed = 0;
+	if (enclosureBandwidth) {
+		size_t parallel = transfers < (size_t) enclosureConnections || !enclosureConnections ?
+		                  transfers : (size_t) enclosureConnections;
+		maxSpeed = enclosureBandwidth / parallel;
+		if (!maxSpeed)
+			maxSpeed = 1;
+	}
+
+	for (size_t i = 0; i < enclosureCount; i++)
+		startEnclosure(&enclosures[i], maxSpeed);
+
+	performRequests(enclosureDone);
+
+	for (size_t i = 0; i < enclosureCount; i++) {
+		enclosureStruct *enc = &enclosures[i];
+
+		if (enc->file) {
+			int err = enc->segments > 1 ? finishSegments(enc) : finishSingle(enc);
+
+			for (int j = 0; j < enc->segments; j++)
+				statAdd(STAT_ENCLOSURE_BYTES, enc->outputs[j].size);
+
+			if (fclose(enc->file) || err || rename(enc->partPath, enc->path)) {
+				logMsg(LOG_ERROR, "Could not download enclosure %s, it will be resumed next time.\n", enc->url);
+				failed++;
+			} else {
+				statAdd(STAT_ENCLOSURES, 1);
+				if (enc->resumed)
+					statAdd(STAT_ENCLOSURES_RESUMED, 1);
+			}
+		}
+
+		struct stat st;
+		enc->failed = stat(enc->path, &st) && !stat(enc->partPath, &st);
+	}
+
+	logMsg(LOG_INFO, "Downloaded %zu enclosures in %.1f s.\n",
+	       enclosureCount - failed, (monoNsec() - start) / 1e9);
+
+	saveLists();
+
+	for (size_t i = 0; i < enclosureCount; i++) {
+		enclosureStruct *enc = &enclosures[i];
+
+		free(enc->outputs);
+		free(enc->url);
+		free(enc->folder);
+		free(enc->name);
+		free(enc->path);
+		free(enc->partPath);
+	}
+
+	free(enclosures);
+	enclosures = NULL;
+	enclosureCount = enclosureCap = 0;
+
+	limitConnections(0, 0);
+
+	return failed;
+}
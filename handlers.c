@@ -22,6 +22,12 @@ You should have received a copy of the GNU General Public License along with thi
 #include "config.h"
 #include "util.h"
 #include "handlers.h"
+#include "index.h"
+#include "retention.h"
+#include "stats.h"
+#include "prefetch.h"
+#include "enclosure.h"
+#include "store.h"
 
 void
 freeItem(itemStruct *item)
@@ -56,7 +62,34 @@ copyField(itemStruct *item, enum fields field, char *str)
 		return;
 	}
 
-	allocField(&item->fields[field], str);
+	size_t len = strlen(str);
+
+	if (len <= maxFieldLen) {
+		allocField(&item->fields[field], str);
+		return;
+	}
+
+	// Truncate without splitting a UTF-8 sequence
+	len = maxFieldLen;
+	while (len && ((unsigned char) str[len] & 0xc0) == 0x80)
+		len--;
+
+	char *fieldStr = ecalloc(len + 1, sizeof(char));
+	memcpy(fieldStr, str, len * sizeof(char));
+	item->fields[field] = fieldStr;
+
+	statAdd(STAT_LIMIT_FIELD, 1);
+}
+
+static void
+enclosureSize(itemStruct *item, xmlNodePtr node)
+{
+	xmlChar *length = xmlGetProp(node, (xmlChar *) "length");
+
+	if (length) {
+		item->numFields[NUM_ENCLOSURE_SIZE] = strtoll((char *) length, NULL, 10);
+		xmlFree(length);
+	}
 }
 
 int
@@ -80,6 +113,8 @@ atomLink(itemStruct *item, xmlNodePtr node)
 		xmlChar *enclosure_type = xmlGetProp(node, (xmlChar *) "type");
 		copyField(item, FIELD_ENCLOSURE_TYPE, (char *)enclosure_type);
 		xmlFree(enclosure_type);
+
+		enclosureSize(item, node);
 	}
 
 	xmlFree(href);
@@ -88,6 +123,38 @@ atomLink(itemStruct *item, xmlNodePtr node)
 	return 0;
 }
 
+void
+feedLink(feedInfoStruct *info, xmlNodePtr node)
+{
+	// Read an Atom link tag of the feed itself (also used in RSS channels).
+
+	xmlChar *href = xmlGetProp(node, (xmlChar *) "href");
+	xmlChar *rel = xmlGetProp(node, (xmlChar *) "rel");
+
+	if (href && rel) {
+		char **field = NULL;
+
+		if (propIs(rel, "hub"))
+			field = &info->hub;
+		else if (propIs(rel, "self"))
+			field = &info->self;
+
+		if (field && !*field)
+			allocField(field, (char *) href);
+	}
+
+	xmlFree(href);
+	xmlFree(rel);
+}
+
+void
+freeFeedInfo(feedInfoStruct *info)
+{
+	free(info->hub);
+	free(info->self);
+	memset(info, 0, sizeof(feedInfoStruct));
+}
+
 int
 rssEnclosure(itemStruct *item, xmlNodePtr node)
 {
@@ -103,6 +170,8 @@ rssEnclosure(itemStruct *item, xmlNodePtr node)
 	xmlChar *enclosure_type = xmlGetProp(node, (xmlChar *) "type");
 	copyField(item, FIELD_ENCLOSURE_TYPE, (char *)enclosure_type);
 	xmlFree(enclosure_type);
+
+	enclosureSize(item, node);
 	
 	return 0;
 }
@@ -160,7 +229,8 @@ outputHtml(itemStruct *item, FILE *f, const char *folder)
 	if (item->fields[FIELD_TITLE])
 		fprintf(f, "<h1>%s</h1><br>\n", item->fields[FIELD_TITLE]);
 
-	fprintf(f, "From feed <b>%s</b><br>\n", folder);
+	if (folder)
+		fprintf(f, "From feed <b>%s</b><br>\n", folder);
 
 	if (item->fields[FIELD_LINK])
 		fprintf(f, "<a href=\"%s\">Link</a><br>\n", item->fields[FIELD_LINK]);
@@ -178,8 +248,9 @@ outputJson(itemStruct *item, FILE *f, const char *folder)
 {
 	json_object *root = json_object_new_object();
 
-	json_object_object_add(root, "feedname",
-			json_object_new_string(folder));
+	if (folder)
+		json_object_object_add(root, "feedname",
+				json_object_new_string(folder));
 
 	if (item->fields[FIELD_TITLE])
 		json_object_object_add(root, "title",
@@ -209,8 +280,45 @@ outputJson(itemStruct *item, FILE *f, const char *folder)
 }
 #endif // JSON
 
+static long
+writeItem(itemStruct *item, FILE *itemFile, const char *folder, const char *fileName,
+          void outputFunction(itemStruct *, FILE *, const char *))
+{
+	// Write a new article to its empty file, which is closed.
+	// Returns the size written, or -1 on error.
+
+	if (!dedupArticles) {
+		outputFunction(item, itemFile, folder);
+		long size = ftell(itemFile);
+		return fclose(itemFile) ? -1 : size;
+	}
+
+	fclose(itemFile);
+
+	// Without the feed name, the same article is written identically
+	// in every feed.
+	char *data = NULL;
+	size_t len = 0;
+	FILE *mem = open_memstream(&data, &len);
+
+	if (!mem)
+		return -1;
+
+	outputFunction(item, mem, NULL);
+	fclose(mem);
+
+	char *filePath = joinPath(folder, fileName);
+	const char *id = item->fields[FIELD_LINK] ? item->fields[FIELD_LINK] : item->fields[FIELD_GUID];
+	int err = remove(filePath) || storeArticle(filePath, data, len, id, item->fields[FIELD_TITLE]);
+
+	free(filePath);
+	free(data);
+
+	return err ? -1 : (long) len;
+}
+
 int
-processItem(itemStruct *item, const char *folder)
+processItem(itemStruct *item, const char *folder, retentionStruct *retention)
 {
 	// Returns 1 if the article is new, 0 if not, -1 for error.
 
@@ -236,7 +344,27 @@ processItem(itemStruct *item, const char *folder)
 			return -1;
 	}
 	
-	char *basename = san(item->fields[FIELD_TITLE]);
+	// Key used to tell apart articles with the same title
+	const char *key = NULL;
+	if (nameHash) {
+		key = item->fields[FIELD_GUID];
+		if (!key)
+			key = item->fields[FIELD_LINK];
+		if (!key)
+			key = item->fields[FIELD_TITLE];
+	}
+
+	char basename[MAX_NAME + 1];
+	char fileName[MAX_NAME + 1];
+
+	size_t extLen = strlen(fileExt);
+	size_t nameLen = sanitize(basename, sizeof(basename) - extLen, item->fields[FIELD_TITLE], key);
+
+	memcpy(fileName, basename, nameLen);
+	memcpy(fileName + nameLen, fileExt, extLen + 1);
+
+	if (skipItem(retention, fileName))
+		return 0;
 
 	FILE *itemFile = openFile(folder, basename, fileExt);
 
@@ -247,43 +375,66 @@ processItem(itemStruct *item, const char *folder)
 				fileExt
 			);
 
-		ret = -1;
-		goto cleanup_basename;
+		return -1;
 	}
 
 	// Do not overwrite files
 	if (!ftell(itemFile)) {
-		outputFunction(item, itemFile, folder);
+		long size = writeItem(item, itemFile, folder, fileName, outputFunction);
+		itemFile = NULL;
+
+		if (size < 0) {
+			logMsg(LOG_ERROR, "Could not write '%s/%s'.\n", folder, fileName);
+			return -1;
+		}
+
 		ret = 1;
 		if (summaryFormat == SUMMARY_FILES)
 			logMsg(LOG_OUTPUT, "%s%c%s%s\n", folder, fsep(), basename, fileExt);
+
+		if (searchIndex) {
+			char *filePath = joinPath(folder, fileName);
+			indexDoc(filePath, item->fields[FIELD_TITLE], item->fields[FIELD_DESCRIPTION]);
+			free(filePath);
+		}
+
+		recordItem(retention, fileName, size);
+		queuePage(item->fields[FIELD_LINK], folder, basename);
 	}
 
-	fclose(itemFile);
-cleanup_basename:
-	free(basename);
+	queueEnclosure(item->fields[FIELD_ENCLOSURE_URL], item->fields[FIELD_ENCLOSURE_TYPE],
+	               item->numFields[NUM_ENCLOSURE_SIZE], folder, basename, ret);
+
+	if (itemFile)
+		fclose(itemFile);
+
 	return ret;
 }
 
 void
-itemAction(itemStruct *item, const char *folder)
+itemAction(itemStruct *item, const char *folder, int partial)
 {
-	// Receives a linked list of articles to process.
+	// Receives a linked list of articles to process. If partial is set,
+	// the list only holds the feed's new articles.
 	
 	itemStruct *cur = item;
 	itemStruct *prev;
 
 	unsigned long long int newItems = 0;
 
+	retentionStruct *retention = openRetention(folder, partial);
+
 	while (cur) {
 		prev = cur;
-		int res = processItem(cur, folder);
+		int res = processItem(cur, folder, retention);
 		if (res == 1)
 			newItems++;
 		cur = cur->next;
 		freeItem(prev);
 	}
 
+	closeRetention(retention);
+
 	switch (summaryFormat) {
 		case SUMMARY_HUMAN_READABLE:
 			if (newItems)
@@ -300,7 +451,9 @@ finish(char *url, long responseCode)
 {
 	// Executed after a download finishes
 
-	if (responseCode == 200)
+	if (responseCode == 304)
+		logMsg(LOG_VERBOSE, "%s has not changed\n", url);
+	else if (responseCode >= 200 && responseCode < 300)
 		logMsg(LOG_VERBOSE, "Finished downloading %s\n", url);
 	else if (!responseCode)
 		logMsg(LOG_ERROR, "Can not reach %s: ensure the protocol is enabled and the site is accessible.\n", url);
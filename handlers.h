@@ -21,11 +21,13 @@ enum fields {
 	FIELD_DESCRIPTION,
 	FIELD_ENCLOSURE_URL,
 	FIELD_ENCLOSURE_TYPE,
+	// RSS guid or Atom id, not saved
+	FIELD_GUID,
 
 	FIELD_END
 };
 enum numFields {
-	// currently unimplemented
+	// length given by the feed, in bytes
 	NUM_ENCLOSURE_SIZE,
 
 	NUM_END
@@ -33,16 +35,26 @@ enum numFields {
 typedef struct itemStruct itemStruct;
 struct itemStruct {
 	char *fields[FIELD_END];
-	int numFields[NUM_END];
+	long long numFields[NUM_END];
 	itemStruct *next;
 };
 
+// Links of the feed itself, as opposed to its articles
+typedef struct {
+	// WebSub hub, and the feed's own URL (the topic for the hub)
+	char *hub;
+	char *self;
+} feedInfoStruct;
+
 void copyField(itemStruct *item, enum fields field, char *str);
 
 void freeItem(itemStruct *item);
-void itemAction(itemStruct *item, const char *folder);
+void itemAction(itemStruct *item, const char *folder, int partial);
 void finish(char *url, long responseCode);
 
 int rssEnclosure(itemStruct *item, xmlNodePtr node);
 
 int atomLink(itemStruct *item, xmlNodePtr node);
+
+void feedLink(feedInfoStruct *info, xmlNodePtr node);
+void freeFeedInfo(feedInfoStruct *info);
@@ -0,0 +1,761 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "util.h"
+#include "stats.h"
+#include "index.h"
+
+/*
+	Inverted index over the titles and descriptions of saved articles.
+
+	Every run that saves new articles writes one segment file to the index
+	folder. A segment is laid out as:
+
+		magic ("MRSSIDX1")
+		article count, then for each article: path length, path
+		term count, then for each term (sorted):
+			term length, term, posting count, posting size in bytes,
+			postings (article numbers as deltas from the previous one)
+
+	All integers are unsigned LEB128 varints. Article numbers are local to
+	a segment. When there are more than maxIndexSegments segments, they
+	are merged into a single one, dropping articles that were deleted.
+*/
+
+#define MIN_TOKEN 2
+#define MAX_TOKEN 64
+
+static const char segMagic[] = "MRSSIDX1";
+#define MAGIC_LEN (sizeof(segMagic) - 1)
+
+typedef struct {
+	char *term;
+	size_t termLen;
+	uint32_t *docs;
+	size_t size;
+	size_t cap;
+} postingStruct;
+
+typedef struct {
+	char **docs;
+	size_t docCount;
+	size_t docCap;
+
+	// Open addressing hash table of terms
+	postingStruct *terms;
+	size_t termCount;
+	size_t termCap;
+} indexStruct;
+
+typedef struct {
+	unsigned char *data;
+	size_t size;
+	size_t pos;
+} readerStruct;
+
+// Articles saved during this run
+static indexStruct pending;
+
+static void
+growTerms(indexStruct *idx)
+{
+	size_t oldCap = idx->termCap;
+	postingStruct *old = idx->terms;
+
+	idx->termCap = oldCap ? oldCap * 2 : 1024;
+	idx->terms = ecalloc(idx->termCap, sizeof(postingStruct));
+
+	size_t mask = idx->termCap - 1;
+
+	for (size_t i = 0; i < oldCap; i++) {
+		if (!old[i].term)
+			continue;
+
+		size_t j = hash64(old[i].term, old[i].termLen) & mask;
+		while (idx->terms[j].term)
+			j = (j + 1) & mask;
+		idx->terms[j] = old[i];
+	}
+
+	free(old);
+}
+
+static postingStruct *
+findTerm(indexStruct *idx, const char *term, size_t len, int create)
+{
+	// Returns the posting list of a term, or NULL if it is missing and
+	// create is not set.
+
+	if (create && (idx->termCount + 1) * 2 > idx->termCap)
+		growTerms(idx);
+
+	if (!idx->termCap)
+		return NULL;
+
+	size_t mask = idx->termCap - 1;
+	size_t i = hash64(term, len) & mask;
+
+	while (idx->terms[i].term) {
+		postingStruct *p = &idx->terms[i];
+		if (p->termLen == len && !memcmp(p->term, term, len))
+			return p;
+		i = (i + 1) & mask;
+	}
+
+	if (!create)
+		return NULL;
+
+	postingStruct *p = &idx->terms[i];
+	p->term = ecalloc(len + 1, sizeof(char));
+	memcpy(p->term, term, len);
+	p->termLen = len;
+	idx->termCount++;
+
+	return p;
+}
+
+static void
+addPosting(postingStruct *p, uint32_t doc)
+{
+	// Article numbers only ever increase, so skip repeated terms.
+	if (p->size && p->docs[p->size - 1] == doc)
+		return;
+
+	if (p->size == p->cap) {
+		p->cap = p->cap ? p->cap * 2 : 4;
+		p->docs = erealloc(p->docs, p->cap * sizeof(uint32_t));
+	}
+
+	p->docs[p->size++] = doc;
+}
+
+static uint32_t
+addDoc(indexStruct *idx, const char *path, size_t len)
+{
+	if (idx->docCount == idx->docCap) {
+		idx->docCap = idx->docCap ? idx->docCap * 2 : 64;
+		idx->docs = erealloc(idx->docs, idx->docCap * sizeof(char *));
+	}
+
+	char *copy = ecalloc(len + 1, sizeof(char));
+	memcpy(copy, path, len);
+	idx->docs[idx->docCount] = copy;
+
+	return idx->docCount++;
+}
+
+static void
+freeIndex(indexStruct *idx)
+{
+	for (size_t i = 0; i < idx->docCount; i++)
+		free(idx->docs[i]);
+
+	for (size_t i = 0; i < idx->termCap; i++) {
+		free(idx->terms[i].term);
+		free(idx->terms[i].docs);
+	}
+
+	free(idx->docs);
+	free(idx->terms);
+	memset(idx, 0, sizeof(indexStruct));
+}
+
+static void
+tokenize(const char *text, void fn(const char *, size_t, void *), void *data)
+{
+	// Split text into lowercase words, skipping HTML tags and entities.
+	// Non-ASCII bytes are kept as part of words.
+
+	char token[MAX_TOKEN];
+	size_t len = 0;
+
+	for (const unsigned char *c = (const unsigned char *) text; ; c++) {
+		unsigned char ch = *c;
+
+		if ((ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch >= 0x80) {
+			if (len < MAX_TOKEN)
+				token[len++] = ch;
+			continue;
+		} else if (ch >= 'A' && ch <= 'Z') {
+			if (len < MAX_TOKEN)
+				token[len++] = ch - 'A' + 'a';
+			continue;
+		}
+
+		if (len >= MIN_TOKEN)
+			fn(token, len, data);
+		len = 0;
+
+		if (!ch)
+			break;
+
+		if (ch == '<') {
+			const char *end = strchr((const char *) c, '>');
+			if (end)
+				c = (const unsigned char *) end;
+		} else if (ch == '&') {
+			size_t n = strspn((const char *) c + 1, "#abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+			if (c[n + 1] == ';')
+				c += n + 1;
+		}
+	}
+}
+
+typedef struct {
+	indexStruct *idx;
+	uint32_t doc;
+} addTokenStruct;
+
+static void
+addToken(const char *token, size_t len, void *data)
+{
+	addTokenStruct *at = data;
+	addPosting(findTerm(at->idx, token, len, 1), at->doc);
+}
+
+void
+indexDoc(const char *path, const char *title, const char *description)
+{
+	// Add a newly saved article to the pending segment.
+
+	if (!searchIndex)
+		return;
+
+	long long start = monoNsec();
+
+	addTokenStruct at = {
+		.idx = &pending,
+		.doc = addDoc(&pending, path, strlen(path)),
+	};
+
+	if (title)
+		tokenize(title, addToken, &at);
+	if (description)
+		tokenize(description, addToken, &at);
+
+	statAdd(STAT_INDEX_ITEMS, 1);
+	statAdd(STAT_INDEX_NSEC, monoNsec() - start);
+}
+
+static void
+putVarint(FILE *f, uint64_t v)
+{
+	while (v >= 0x80) {
+		fputc((v & 0x7f) | 0x80, f);
+		v >>= 7;
+	}
+	fputc(v, f);
+}
+
+static size_t
+encodeVarint(unsigned char *buf, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+
+	return n;
+}
+
+static int
+getVarint(readerStruct *r, uint64_t *v)
+{
+	*v = 0;
+
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (r->pos >= r->size)
+			return 1;
+
+		unsigned char byte = r->data[r->pos++];
+		*v |= (uint64_t) (byte & 0x7f) << shift;
+
+		if (!(byte & 0x80))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+cmpTerms(const void *a, const void *b)
+{
+	const postingStruct *x = *(const postingStruct **) a;
+	const postingStruct *y = *(const postingStruct **) b;
+
+	return strcmp(x->term, y->term);
+}
+
+static char *
+segmentPath(const char *dir, unsigned long id)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "seg-%lu", id);
+
+	return joinPath(dir, name);
+}
+
+static int
+writeSegment(indexStruct *idx, const char *dir, unsigned long id)
+{
+	// Write to a temporary file, then link it as the first free segment
+	// id from id on. Readers never see a partial segment, and processes
+	// sharing the index (see --shard) never overwrite each other's.
+
+	char tmpName[32];
+	snprintf(tmpName, sizeof(tmpName), "tmp-%ld", (long) getpid());
+	char *tmpPath = joinPath(dir, tmpName);
+
+	FILE *f = fopen(tmpPath, "wb");
+	if (!f) {
+		logMsg(LOG_ERROR, "Could not write index segment %s.\n", tmpPath);
+		free(tmpPath);
+		return 1;
+	}
+
+	fwrite(segMagic, 1, MAGIC_LEN, f);
+
+	putVarint(f, idx->docCount);
+	for (size_t i = 0; i < idx->docCount; i++) {
+		size_t len = strlen(idx->docs[i]);
+		putVarint(f, len);
+		fwrite(idx->docs[i], 1, len, f);
+	}
+
+	postingStruct **sorted = ecalloc(idx->termCount + 1, sizeof(postingStruct *));
+	size_t n = 0;
+	for (size_t i = 0; i < idx->termCap; i++) {
+		if (idx->terms[i].term && idx->terms[i].size)
+			sorted[n++] = &idx->terms[i];
+	}
+	qsort(sorted, n, sizeof(postingStruct *), cmpTerms);
+
+	unsigned char *block = NULL;
+	size_t blockCap = 0;
+
+	putVarint(f, n);
+	for (size_t i = 0; i < n; i++) {
+		postingStruct *p = sorted[i];
+
+		if (blockCap < p->size * 5) {
+			blockCap = p->size * 5;
+			block = erealloc(block, blockCap);
+		}
+
+		size_t blockLen = 0;
+		uint32_t prev = 0;
+		for (size_t j = 0; j < p->size; j++) {
+			blockLen += encodeVarint(block + blockLen, p->docs[j] - prev);
+			prev = p->docs[j];
+		}
+
+		putVarint(f, p->termLen);
+		fwrite(p->term, 1, p->termLen, f);
+		putVarint(f, p->size);
+		putVarint(f, blockLen);
+		fwrite(block, 1, blockLen, f);
+	}
+
+	free(block);
+	free(sorted);
+
+	int err = ferror(f);
+	if (fclose(f) || err) {
+		logMsg(LOG_ERROR, "Could not write index segment %s.\n", tmpPath);
+		remove(tmpPath);
+		free(tmpPath);
+		return 1;
+	}
+
+	for (;; id++) {
+		char *path = segmentPath(dir, id);
+		err = link(tmpPath, path);
+		free(path);
+
+		if (!err || errno != EEXIST)
+			break;
+	}
+
+	if (err)
+		logMsg(LOG_ERROR, "Could not add index segment: %s.\n", strerror(errno));
+
+	remove(tmpPath);
+	free(tmpPath);
+
+	return err != 0;
+}
+
+static int
+loadSegment(indexStruct *idx, const char *path, int dropDeleted)
+{
+	// Append a segment's articles and postings to idx.
+	// With dropDeleted, articles whose file no longer exists are skipped.
+
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		logMsg(LOG_ERROR, "Could not read index segment %s.\n", path);
+		return 1;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	readerStruct r = {
+		.data = ecalloc(size > 0 ? size : 1, 1),
+		.size = size > 0 ? size : 0,
+	};
+
+	int ret = 1;
+	uint32_t *docMap = NULL;
+
+	if (fread(r.data, 1, r.size, f) != r.size ||
+	        r.size < MAGIC_LEN ||
+	        memcmp(r.data, segMagic, MAGIC_LEN))
+		goto cleanup;
+	r.pos = MAGIC_LEN;
+
+	uint64_t docCount, termCount, len;
+
+	if (getVarint(&r, &docCount) || docCount > r.size)
+		goto cleanup;
+
+	// Segment article number -> article number in idx, UINT32_MAX if dropped
+	docMap = ecalloc(docCount + 1, sizeof(uint32_t));
+
+	for (uint64_t i = 0; i < docCount; i++) {
+		if (getVarint(&r, &len) || len > r.size - r.pos)
+			goto cleanup;
+
+		char *docPath = (char *) r.data + r.pos;
+		r.pos += len;
+
+		docMap[i] = UINT32_MAX;
+		if (dropDeleted) {
+			struct stat st;
+			char *copy = ecalloc(len + 1, sizeof(char));
+			memcpy(copy, docPath, len);
+			int missing = stat(copy, &st);
+			free(copy);
+			if (missing)
+				continue;
+		}
+		docMap[i] = addDoc(idx, docPath, len);
+	}
+
+	if (getVarint(&r, &termCount))
+		goto cleanup;
+
+	for (uint64_t i = 0; i < termCount; i++) {
+		uint64_t postCount, blockLen;
+
+		if (getVarint(&r, &len) || len > r.size - r.pos)
+			goto cleanup;
+
+		postingStruct *p = findTerm(idx, (char *) r.data + r.pos, len, 1);
+		r.pos += len;
+
+		if (getVarint(&r, &postCount) || getVarint(&r, &blockLen) ||
+		        blockLen > r.size - r.pos)
+			goto cleanup;
+
+		readerStruct block = {
+			.data = r.data + r.pos,
+			.size = blockLen,
+		};
+		r.pos += blockLen;
+
+		uint64_t doc = 0;
+		for (uint64_t j = 0; j < postCount; j++) {
+			uint64_t delta;
+			if (getVarint(&block, &delta))
+				goto cleanup;
+			doc += delta;
+			if (doc >= docCount)
+				goto cleanup;
+			if (docMap[doc] != UINT32_MAX)
+				addPosting(p, docMap[doc]);
+		}
+	}
+
+	ret = 0;
+
+cleanup:
+	if (ret)
+		logMsg(LOG_ERROR, "Corrupt index segment %s.\n", path);
+
+	free(docMap);
+	free(r.data);
+	fclose(f);
+
+	return ret;
+}
+
+static int
+cmpIds(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *) a;
+	unsigned long y = *(const unsigned long *) b;
+
+	return (x > y) - (x < y);
+}
+
+static size_t
+listSegments(const char *dir, unsigned long **ids)
+{
+	// Returns the number of segments in dir, with their ids sorted in *ids.
+
+	*ids = NULL;
+
+	DIR *d = opendir(dir);
+	if (!d)
+		return 0;
+
+	size_t count = 0, cap = 0;
+	struct dirent *ent;
+
+	while ((ent = readdir(d))) {
+		unsigned long id;
+		char end;
+
+		if (sscanf(ent->d_name, "seg-%lu%c", &id, &end) != 1)
+			continue;
+
+		if (count == cap) {
+			cap = cap ? cap * 2 : 16;
+			*ids = erealloc(*ids, cap * sizeof(unsigned long));
+		}
+		(*ids)[count++] = id;
+	}
+
+	closedir(d);
+
+	qsort(*ids, count, sizeof(unsigned long), cmpIds);
+
+	return count;
+}
+
+static void
+mergeSegments(const char *dir, unsigned long *ids, size_t count)
+{
+	// Combine segments into a new one that replaces them.
+
+	long long start = monoNsec();
+
+	// Only one process merges at a time. A lock older than an hour was
+	// left behind by a process that died.
+	char *lockPath = joinPath(dir, "merge.lock");
+	int lock = open(lockPath, O_CREAT | O_EXCL | O_WRONLY, S_IRUSR | S_IWUSR);
+	struct stat st;
+
+	if (lock < 0 && errno == EEXIST && !stat(lockPath, &st) &&
+	        time(NULL) - st.st_mtime > 3600) {
+		remove(lockPath);
+		lock = open(lockPath, O_CREAT | O_EXCL | O_WRONLY, S_IRUSR | S_IWUSR);
+	}
+
+	if (lock < 0) {
+		free(lockPath);
+		return;
+	}
+	close(lock);
+
+	indexStruct merged = {0};
+	int err = 0;
+
+	for (size_t i = 0; i < count && !err; i++) {
+		char *path = segmentPath(dir, ids[i]);
+		err = loadSegment(&merged, path, 1);
+		free(path);
+	}
+
+	if (!err)
+		err = writeSegment(&merged, dir, ids[count - 1] + 1);
+
+	if (!err) {
+		for (size_t i = 0; i < count; i++) {
+			char *path = segmentPath(dir, ids[i]);
+			remove(path);
+			free(path);
+		}
+	}
+
+	if (!err)
+		logMsg(LOG_INFO, "Merged %zu index segments (%zu articles) in %.1f ms.\n",
+		       count, merged.docCount, (monoNsec() - start) / 1e6);
+
+	freeIndex(&merged);
+	remove(lockPath);
+	free(lockPath);
+}
+
+int
+indexFlush()
+{
+	// Write the articles saved during this run to a new segment.
+
+	if (!searchIndex || !pending.docCount)
+		return 0;
+
+	long long start = monoNsec();
+
+	char *dir = joinPath(stateDir, "index");
+	unsigned long *ids;
+	int ret = 1;
+
+	if (makeDir(stateDir) || makeDir(dir))
+		goto cleanup;
+
+	size_t count = listSegments(dir, &ids);
+
+	ret = writeSegment(&pending, dir, count ? ids[count - 1] + 1 : 0);
+
+	long long items = statGet(STAT_INDEX_ITEMS);
+	logMsg(LOG_INFO, "Indexed %lld articles, %.1f us per article, %.1f ms to write.\n",
+	       items,
+	       statGet(STAT_INDEX_NSEC) / 1e3 / (items ? items : 1),
+	       (monoNsec() - start) / 1e6);
+
+	free(ids);
+
+	if (!ret) {
+		count = listSegments(dir, &ids);
+		if (count > maxIndexSegments)
+			mergeSegments(dir, ids, count);
+		free(ids);
+	}
+
+cleanup:
+	free(dir);
+	freeIndex(&pending);
+
+	return ret;
+}
+
+typedef struct {
+	indexStruct *idx;
+	uint32_t *results;
+	size_t size;
+	int first;
+} searchStruct;
+
+static void
+matchToken(const char *token, size_t len, void *data)
+{
+	// Intersect the running results with the postings of a token.
+
+	searchStruct *s = data;
+	postingStruct *p = findTerm(s->idx, token, len, 0);
+
+	if (!p) {
+		s->size = 0;
+		s->first = 0;
+		return;
+	}
+
+	if (s->first) {
+		s->results = ecalloc(p->size, sizeof(uint32_t));
+		memcpy(s->results, p->docs, p->size * sizeof(uint32_t));
+		s->size = p->size;
+		s->first = 0;
+		return;
+	}
+
+	size_t i = 0, j = 0, n = 0;
+	while (i < s->size && j < p->size) {
+		if (s->results[i] < p->docs[j]) {
+			i++;
+		} else if (s->results[i] > p->docs[j]) {
+			j++;
+		} else {
+			s->results[n++] = s->results[i];
+			i++;
+			j++;
+		}
+	}
+	s->size = n;
+}
+
+static int
+cmpPaths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int
+indexSearch(char **terms, int termCount)
+{
+	// Print the paths of saved articles that contain all the terms.
+
+	char *dir = joinPath(stateDir, "index");
+	unsigned long *ids;
+	size_t count = listSegments(dir, &ids);
+
+	if (!count) {
+		free(dir);
+		logMsg(LOG_ERROR, "No search index found, enable searchIndex in config.h.\n");
+		return 1;
+	}
+
+	indexStruct idx = {0};
+
+	for (size_t i = 0; i < count; i++) {
+		char *path = segmentPath(dir, ids[i]);
+		loadSegment(&idx, path, 0);
+		free(path);
+	}
+
+	searchStruct s = {
+		.idx = &idx,
+		.first = 1,
+	};
+
+	for (int i = 0; i < termCount; i++)
+		tokenize(terms[i], matchToken, &s);
+
+	// An article saved again after being deleted appears more than once.
+	char **paths = ecalloc(s.size + 1, sizeof(char *));
+	for (size_t i = 0; i < s.size; i++)
+		paths[i] = idx.docs[s.results[i]];
+	qsort(paths, s.size, sizeof(char *), cmpPaths);
+
+	for (size_t i = 0; i < s.size; i++) {
+		struct stat st;
+		if (i && !strcmp(paths[i], paths[i - 1]))
+			continue;
+		if (!stat(paths[i], &st))
+			logMsg(LOG_OUTPUT, "%s\n", paths[i]);
+	}
+
+	free(paths);
+
+	free(s.results);
+	freeIndex(&idx);
+	free(ids);
+	free(dir);
+
+	return 0;
+}
@@ -15,6 +15,7 @@ You should have received a copy of the GNU General Public License along with thi
 #include <string.h>
 #include <time.h>
 #include <utime.h>
+#include <unistd.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/xmlreader.h>
@@ -25,8 +26,21 @@ You should have received a copy of the GNU General Public License along with thi
 #include "util.h"
 #include "net.h"
 #include "handlers.h"
+#include "index.h"
+#include "stats.h"
+#include "state.h"
+#include "prefetch.h"
+#include "enclosure.h"
+#include "dns.h"
+#include "websub.h"
+#include "store.h"
+#include "retention.h"
 #include "config.h"
 
+// Documents are parsed in chunks of this size, checking maxParseTime
+// between them
+#define PARSE_CHUNK 65536
+
 static inline int
 tagIs(xmlNodePtr node, char *str)
 {
@@ -36,7 +50,10 @@ tagIs(xmlNodePtr node, char *str)
 static int
 parseXml(xmlDocPtr doc,
          const char *feedName,
-         void itemAction(itemStruct *, const char *))
+         int partial,
+         void itemAction(itemStruct *, const char *, int),
+         feedInfoStruct *info,
+         long long startTime)
 {
 	// Parse the XML in a single document.
 
@@ -100,9 +117,20 @@ parseXml(xmlDocPtr doc,
 	// Previous item (to build a linked list later)
 	itemStruct *prev = NULL;
 
+	unsigned long itemCount = 0;
+	// Set if the articles after the limits were left out
+	int cut = 0;
+
 	// Loop over articles (skipping non-article tags)
 	while (cur) {
 
+		if (maxParseTime && monoNsec() - startTime > maxParseTime * 1000000) {
+			logMsg(LOG_ERROR, "Parsing %s took longer than maxParseTime, skipping the remaining articles.\n", feedName);
+			statAdd(STAT_LIMIT_PARSE_TIME, 1);
+			cut = 1;
+			break;
+		}
+
 		short isArticle = 0;
 
 		switch (format) {
@@ -117,6 +145,16 @@ parseXml(xmlDocPtr doc,
 				return 1;
 		}
 
+		if (!isArticle && info && tagIs(cur, "link"))
+			feedLink(info, cur);
+
+		if (isArticle && maxFeedItems && itemCount++ >= maxFeedItems) {
+			logMsg(LOG_ERROR, "%s has more than maxFeedItems articles, skipping the rest.\n", feedName);
+			statAdd(STAT_LIMIT_ITEMS, 1);
+			cut = 1;
+			break;
+		}
+
 		if (isArticle) {
 			itemStruct *item = ecalloc(1, sizeof(itemStruct));
 
@@ -142,6 +180,8 @@ parseXml(xmlDocPtr doc,
 							copyField(item, FIELD_TITLE, itemKey);
 						else if (tagIs(itemNode, "enclosure"))
 							rssEnclosure(item, itemNode);
+						else if (tagIs(itemNode, "guid"))
+							copyField(item, FIELD_GUID, itemKey);
 						break;
 					case ATOM:
 						if (tagIs(itemNode, "link"))
@@ -150,6 +190,8 @@ parseXml(xmlDocPtr doc,
 							copyField(item, FIELD_DESCRIPTION, itemKey);
 						else if (tagIs(itemNode, "title"))
 							copyField(item, FIELD_TITLE, itemKey);
+						else if (tagIs(itemNode, "id"))
+							copyField(item, FIELD_GUID, itemKey);
 						break;
 					default:
 						break;
@@ -172,27 +214,84 @@ parseXml(xmlDocPtr doc,
 		return 1;
 	}
 
-	itemAction(prev, feedName);
+	// Retention must not take the articles left out for gone from the
+	// feed, or the ones it evicted would come back as new.
+	itemAction(prev, feedName, partial || cut);
 
 	return 0;
 }
 
+static xmlDocPtr
+readXml(const char *content, const char *feedName, long long startTime)
+{
+	// Parse a document with a push parser, so that parsing stops once
+	// it takes longer than maxParseTime. Returns NULL on error.
+
+	size_t len = strlen(content);
+	size_t first = len < 4 ? len : 4;
+
+	// The first bytes tell the parser the encoding.
+	xmlParserCtxtPtr ctxt = xmlCreatePushParserCtxt(NULL, NULL, content, first, "noname.xml");
+	if (!ctxt) {
+		logMsg(LOG_ERROR, "Can not create the XML parser.\n");
+		return NULL;
+	}
+
+	xmlCtxtUseOptions(ctxt, xmlOptions);
+
+	// Like xmlReadMemory(), only keep documents that are well-formed.
+	int recover = xmlOptions & XML_PARSE_RECOVER;
+	int timedOut = 0;
+
+	for (size_t pos = first; ctxt->wellFormed || recover; pos += PARSE_CHUNK) {
+		size_t chunk = len - pos < PARSE_CHUNK ? len - pos : PARSE_CHUNK;
+		int last = pos + chunk == len;
+
+		xmlParseChunk(ctxt, content + pos, chunk, last);
+
+		if (last)
+			break;
+
+		if (maxParseTime && monoNsec() - startTime > maxParseTime * 1000000) {
+			logMsg(LOG_ERROR, "Parsing %s took longer than maxParseTime, skipping it.\n", feedName);
+			statAdd(STAT_LIMIT_PARSE_TIME, 1);
+			timedOut = 1;
+			break;
+		}
+	}
+
+	xmlDocPtr doc = ctxt->myDoc;
+
+	if (timedOut || (!ctxt->wellFormed && !recover)) {
+		if (!timedOut)
+			logMsg(LOG_ERROR, "XML parser error.\n");
+		xmlFreeDoc(doc);
+		doc = NULL;
+	}
+
+	xmlFreeParserCtxt(ctxt);
+
+	return doc;
+}
+
 int
 readDoc(char *content,
         const char *feedName,
-        void itemAction(itemStruct *, const char *))
+        int partial,
+        void itemAction(itemStruct *, const char *, int),
+        feedInfoStruct *info)
 {
-	// Initialize the XML document, read it, then free it
+	// Initialize the XML document, read it, then free it.
+	// Set partial if the document only holds the new articles.
+	// If info is set, it receives the feed's own links.
 
-	xmlDocPtr doc;
+	long long startTime = monoNsec();
 
-	doc = xmlReadMemory(content, strlen(content), "noname.xml", NULL, 0);
-	if (!doc) {
-		logMsg(LOG_ERROR, "XML parser error.\n");
+	xmlDocPtr doc = readXml(content, feedName, startTime);
+	if (!doc)
 		return 1;
-	}
 
-	int stat = parseXml(doc, feedName, itemAction);
+	int stat = parseXml(doc, feedName, partial, itemAction, info, startTime);
 
 	if (stat)
 		logMsg(LOG_ERROR, "Skipped feed %s due to errors.\n", feedName);
@@ -202,21 +301,95 @@ readDoc(char *content,
 	return stat;
 }
 
-int
-main(int argc, char *argv[])
+static void
+updateBreaker(const linkStruct *link, const outputStruct *output, feedStateStruct *state, time_t timeNow)
+{
+	// Count failed updates in a row, and stop polling the feed for a
+	// while once there are too many.
+
+	if (!requestFailed(output)) {
+		if (state->failures) {
+			state->failures = 0;
+			state->retryAt = 0;
+			saveState(link->feedName, state);
+		}
+		return;
+	}
+
+	statAdd(STAT_FAILED_FEEDS, 1);
+	state->failures++;
+
+	if (state->failures >= breakerThreshold) {
+		time_t delay = breakerBaseDelay;
+		for (unsigned long i = breakerThreshold; i < state->failures && delay < breakerMaxDelay; i++)
+			delay *= 2;
+		if (delay > breakerMaxDelay)
+			delay = breakerMaxDelay;
+
+		state->retryAt = timeNow + delay;
+		logMsg(LOG_ERROR, "%s failed %lu times in a row, not polling it for %lld s.\n",
+		       link->feedName, state->failures, (long long) delay);
+	}
+
+	saveState(link->feedName, state);
+}
+
+static void
+updateValidators(const linkStruct *link, const outputStruct *output, feedStateStruct *state)
+{
+	// Remember the validators of the version of a feed that was saved.
+
+	const char *etag = output->etag;
+
+	if (!etag || strlen(etag) >= sizeof(state->etag) || strchr(etag, ' '))
+		etag = "";
+
+	int noDelta = state->noDelta || output->deltaRejected;
+
+	if (!strcmp(etag, state->etag) && output->modified == state->modified && noDelta == state->noDelta)
+		return;
+
+	strcpy(state->etag, etag);
+	state->modified = output->modified;
+	state->noDelta = noDelta;
+	saveState(link->feedName, state);
+}
+
+static int
+inShard(const linkStruct *link, int shard, int shards)
+{
+	// Check if this process is responsible for the feed. Feeds are
+	// spread with a consistent hash, so adding a shard only moves the
+	// feeds (and state) that the new shard takes over.
+
+	if (shards <= 1)
+		return 1;
+
+	char *host = shardByHost ? urlHost(link->url, NULL) : NULL;
+	const char *key = host ? host : link->url;
+	int owner = jumpHash(hash64(key, strlen(key)), shards);
+
+	free(host);
+
+	return owner == shard;
+}
+
+static void
+updateFeeds(int shard, int shards)
 {
-	if (argc == 2 && !strcmp("-v", argv[1]))
-		logMsg(LOG_FATAL, "MinRSS %s\n", VERSION);
-	else if (argc != 1)
-		logMsg(LOG_FATAL, "Usage: minrss [-v]\n");
+	// Update the feeds that are due, then fetch what their new articles
+	// link to.
 
 	unsigned int i = 0;
 
 	initCurl();
+	loadDns();
 
 	outputStruct outputs[LEN(links)];
 	memset(outputs, 0, sizeof(outputs));
 
+	feedStateStruct states[LEN(links)];
+
 	time_t timeNow = time(NULL);
 
 	for (i = 0; i < LEN(links); i++) {
@@ -225,10 +398,41 @@ main(int argc, char *argv[])
 		if (links[0].url[0] == '\0')
 			logMsg(LOG_FATAL, "No feeds, add them in config.def.h\n");
 
-		if (stat(links[i].feedName, &feedDir) == 0) {
+		if (!inShard(&links[i], shard, shards))
+			continue;
+
+		int haveDir = !stat(links[i].feedName, &feedDir);
+
+		if (haveDir) {
 			time_t deltaTime = timeNow - feedDir.st_atime;
-			if (deltaTime < links[i].update)
+			if (deltaTime < links[i].update) {
+				prefetchDns(links[i].url, feedDir.st_atime + links[i].update);
 				continue;
+			}
+		}
+
+		loadState(links[i].feedName, &states[i]);
+		if (states[i].retryAt > timeNow) {
+			logMsg(LOG_VERBOSE, "Skipping %s, it failed too many times.\n", links[i].url);
+			statAdd(STAT_BREAKER_SKIPS, 1);
+			continue;
+		}
+
+		if (pushedFeed(i, timeNow)) {
+			logMsg(LOG_VERBOSE, "Skipping %s, its hub pushes updates.\n", links[i].url);
+			continue;
+		}
+
+		outputs[i].conditional = 1;
+
+		// Without the saved articles, the whole feed is needed.
+		if (haveDir) {
+			if (states[i].etag[0]) {
+				outputs[i].etag = ecalloc(strlen(states[i].etag) + 1, sizeof(char));
+				strcpy(outputs[i].etag, states[i].etag);
+			}
+			outputs[i].modified = states[i].modified;
+			outputs[i].deltaFeed = deltaFeeds && !states[i].noDelta;
 		}
 
 		logMsg(LOG_VERBOSE, "Requesting %s\n", links[i].url);
@@ -237,28 +441,182 @@ main(int argc, char *argv[])
 
 	performRequests(finish);
 
+	// The feeds that finished downloading are still saved.
+	int stopping = stopRequested();
+
 	logMsg(LOG_INFO, "Finished downloads.\n");
 
 	for (i = 0; i < LEN(links); i++) {
-		logMsg(LOG_VERBOSE, "Parsing %s\n", links[i].url);
+		if (!outputs[i].attempts) {
+			free(outputs[i].buffer);
+			free(outputs[i].etag);
+			continue;
+		}
 
-		if (outputs[i].buffer && outputs[i].buffer[0]) {
-			if (readDoc(outputs[i].buffer, links[i].feedName, itemAction) == 0) {
-				struct stat feedDir;
+		int tooLarge = outputs[i].tooLarge || outputs[i].result == CURLE_FILESIZE_EXCEEDED;
 
-				if (stat(links[i].feedName, &feedDir) == 0) {
-					struct utimbuf update;
+		if (tooLarge) {
+			logMsg(LOG_ERROR, "%s is larger than maxFeedSize, skipping it.\n", links[i].url);
+			statAdd(STAT_LIMIT_SIZE, 1);
+		}
 
-					update.actime = timeNow;
-					update.modtime = feedDir.st_mtime;
-					utime(links[i].feedName, &update);
-				}
+		// The server of a feed over the limits is working, and a dropped
+		// transfer says nothing about the feed.
+		if (!tooLarge && outputs[i].result != CURLE_ABORTED_BY_CALLBACK)
+			updateBreaker(&links[i], &outputs[i], &states[i], timeNow);
+
+		setLogFeed(links[i].feedName);
+
+		int updated = 0;
+
+		if (!requestFailed(&outputs[i]) && outputs[i].responseCode == 304) {
+			updated = 1;
+			noteHub(i, NULL, NULL);
+			checkRetention(links[i].feedName);
+		} else if (!requestFailed(&outputs[i]) && outputs[i].partial &&
+		           !(outputs[i].buffer && outputs[i].buffer[0])) {
+			// A delta with no new articles: the feed did not change.
+			updated = 1;
+			updateValidators(&links[i], &outputs[i], &states[i]);
+			noteHub(i, NULL, NULL);
+			checkRetention(links[i].feedName);
+		} else if (!requestFailed(&outputs[i]) && outputs[i].buffer && outputs[i].buffer[0]) {
+			logMsg(LOG_VERBOSE, "Parsing %s%s\n", links[i].url,
+			       outputs[i].partial ? " (new articles only)" : "");
+
+			feedInfoStruct info = {0};
+
+			updated = !readDoc(outputs[i].buffer, links[i].feedName, outputs[i].partial, itemAction, &info);
+			if (updated) {
+				updateValidators(&links[i], &outputs[i], &states[i]);
+				// A delta may leave out the feed's links.
+				noteHub(i, info.hub ? info.hub : outputs[i].partial ? NULL : "", info.self);
 			}
-			free(outputs[i].buffer);
+
+			freeFeedInfo(&info);
 		}
+
+		if (updated) {
+			struct stat feedDir;
+
+			if (stat(links[i].feedName, &feedDir) == 0) {
+				struct utimbuf update;
+
+				update.actime = timeNow;
+				update.modtime = feedDir.st_mtime;
+				utime(links[i].feedName, &update);
+			}
+		}
+
+		resumeEnclosures(links[i].feedName);
+
+		free(outputs[i].buffer);
+		free(outputs[i].etag);
+		setLogFeed(NULL);
 	}
 
 	logMsg(LOG_INFO, "Finished parsing feeds.\n");
 
+	if (!stopping) {
+		sendSubscriptions();
+		fetchPages();
+		fetchEnclosures();
+	}
+	saveDns();
+	cleanupCurl();
+
+	indexFlush();
+	if (dedupArticles)
+		pruneStore();
+	printStats();
+}
+
+static int
+serveFeeds(int shard, int shards)
+{
+	// Keep running: update the feeds that are due every serveInterval
+	// seconds, and in between, receive the updates that WebSub hubs push.
+
+	int sock = -1;
+
+	if (callbackUrl[0] && (sock = openCallback()) < 0)
+		logMsg(LOG_FATAL, "Could not listen for WebSub hubs on port %s.\n", listenPort);
+
+	while (!stopRequested()) {
+		updateFeeds(shard, shards);
+		resetStats();
+		fflush(NULL);
+
+		time_t next = time(NULL) + serveInterval;
+
+		for (time_t now = time(NULL); now < next && !stopRequested(); now = time(NULL)) {
+			char *body = NULL;
+			long feed = serveCallback(sock, (next - now) * 1000, &body);
+
+			if (feed < 0)
+				continue;
+
+			setLogFeed(links[feed].feedName);
+			logMsg(LOG_VERBOSE, "Parsing the update pushed for %s\n", links[feed].url);
+			readDoc(body, links[feed].feedName, 1, itemAction, NULL);
+			setLogFeed(NULL);
+
+			free(body);
+			fflush(NULL);
+		}
+	}
+
+	if (sock >= 0)
+		close(sock);
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	initLog();
+
+	int argi;
+	int shard = 0, shards = 1;
+
+	for (argi = 1; argi < argc && argv[argi][0] == '-'; argi++) {
+		if (!strcmp("-v", argv[argi]))
+			logMsg(LOG_FATAL, "MinRSS %s\n", VERSION);
+		else if (!strcmp("-l", argv[argi]) && argi + 1 < argc && !setLogLevel(argv[argi + 1]))
+			argi++;
+		else if (!strcmp("-j", argv[argi]))
+			setLogFormat(LOG_FORMAT_JSON);
+		else if (!strcmp("--shard", argv[argi]) && argi + 1 < argc &&
+		         sscanf(argv[argi + 1], "%d/%d", &shard, &shards) == 2 &&
+		         shard >= 0 && shard < shards)
+			argi++;
+		else
+			break;
+	}
+
+	int serve = 0;
+
+	if (argi + 1 < argc && !strcmp("search", argv[argi]))
+		return indexSearch(argv + argi + 1, argc - argi - 1);
+	else if (argi + 1 == argc && !strcmp("serve", argv[argi]))
+		serve = 1;
+	else if (argi != argc)
+		logMsg(LOG_FATAL, "Usage: minrss [-v] [-l level] [-j] [--shard i/N] [serve | search <terms>]\n");
+
+	// Every shard would listen on listenPort, and hubs only know one
+	// callbackUrl.
+	if (serve && shards > 1 && callbackUrl[0])
+		logMsg(LOG_FATAL, "WebSub can not be used with --shard: set callbackUrl to \"\" or run a single 'minrss serve'.\n");
+
+	catchSignals();
+
+	if (serve)
+		serveFeeds(shard, shards);
+	else
+		updateFeeds(shard, shards);
+
+	releaseSignals();
+
 	return 0;
 }
@@ -13,13 +13,44 @@ You should have received a copy of the GNU General Public License along with thi
 #include <curl/easy.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#endif // __linux__
 
 #include "net.h"
 #include "util.h"
 #include "config.h"
+#include "stats.h"
+#include "dns.h"
 
 static CURLM *multiHandle;
 
+// Transfers waiting to be retried
+typedef struct {
+	CURL *handle;
+	long long due;
+} retryStruct;
+
+static retryStruct *retries;
+static size_t retryCount;
+static size_t retryCap;
+
+// Transfers currently added to the multi handle
+static size_t transferCount;
+
+#ifdef __linux__
+// Readable once SIGINT or SIGTERM is received, see catchSignals()
+static int signalFd = -1;
+static sigset_t oldSignals;
+#endif // __linux__
+// Signal that asked to stop, 0 if none
+static int stopSignal;
+
 int
 initCurl()
 {
@@ -28,9 +59,29 @@ initCurl()
 	curl_global_init(CURL_GLOBAL_ALL);
 	multiHandle = curl_multi_init();
 
+	// Only used to jitter retry delays
+	srand(time(NULL));
+
 	return !multiHandle;
 }
 
+void
+cleanupCurl()
+{
+	curl_multi_cleanup(multiHandle);
+	curl_global_cleanup();
+}
+
+void
+limitConnections(long total, long perHost)
+{
+	// Limit parallel connections for the following transfers, 0 for
+	// no limit. Transfers over the limit wait in curl's queue.
+
+	curl_multi_setopt(multiHandle, CURLMOPT_MAX_TOTAL_CONNECTIONS, total);
+	curl_multi_setopt(multiHandle, CURLMOPT_MAX_HOST_CONNECTIONS, perHost);
+}
+
 static size_t
 writeCallback(void *ptr, size_t size, size_t nmemb, void *data)
 {
@@ -40,22 +91,44 @@ writeCallback(void *ptr, size_t size, size_t nmemb, void *data)
 
 	outputStruct *mem = (outputStruct*) data;
 
-	mem->buffer = realloc(mem->buffer, mem->size + realsize + 1);
+	// Returning less than realsize aborts the transfer.
+	if (mem->maxSize && mem->size + realsize > (size_t) mem->maxSize) {
+		mem->tooLarge = 1;
+		return 0;
+	}
 
-	if (mem->buffer) {
-		memcpy(&(mem->buffer[mem->size]), ptr, realsize);
+	if (mem->file) {
+		size_t written;
 
-		mem->size += realsize;
-		mem->buffer[mem->size] = 0;
+		if (mem->positioned) {
+			ssize_t ret = pwrite(fileno(mem->file), ptr, realsize, mem->offset + mem->size);
+			written = ret < 0 ? 0 : ret;
+		} else {
+			written = fwrite(ptr, 1, realsize, mem->file);
+		}
+
+		mem->size += written;
+		return written;
 	}
 
+	char *buffer = realloc(mem->buffer, mem->size + realsize + 1);
+
+	if (!buffer)
+		return 0;
+
+	mem->buffer = buffer;
+	memcpy(&(mem->buffer[mem->size]), ptr, realsize);
+
+	mem->size += realsize;
+	mem->buffer[mem->size] = 0;
+
 	return realsize;
 }
 
-int
-createRequest(const char* url, outputStruct *output)
+static CURL *
+initRequest(const char* url, outputStruct *output)
 {
-	// Create the curl request for an URL.
+	// Create a curl handle with the options shared by all requests.
 
 	CURL *requestHandle = curl_easy_init();
 
@@ -75,57 +148,753 @@ createRequest(const char* url, outputStruct *output)
 	stat = curl_easy_setopt(requestHandle, CURLOPT_MAXREDIRS, maxRedirs);
 	stat = curl_easy_setopt(requestHandle, CURLOPT_PROTOCOLS_STR, curlProtocols);
 	stat = curl_easy_setopt(requestHandle, CURLOPT_FOLLOWLOCATION, 1L);
+	stat = curl_easy_setopt(requestHandle, CURLOPT_PRIVATE, (void*)output);
+	stat = curl_easy_setopt(requestHandle, CURLOPT_CONNECTTIMEOUT, connectTimeout);
+	stat = curl_easy_setopt(requestHandle, CURLOPT_LOW_SPEED_LIMIT, lowSpeedLimit);
+	stat = curl_easy_setopt(requestHandle, CURLOPT_LOW_SPEED_TIME, lowSpeedTime);
+
+	applyDns(requestHandle, url);
 
 	if (stat) {
 		fprintf(stderr, "Unexpected curl error: %s.\n", curl_easy_strerror(stat));
-		return 1;
+		curl_easy_cleanup(requestHandle);
+		return NULL;
 	}
 
+	return requestHandle;
+}
+
+static int
+addRequest(CURL *requestHandle)
+{
 	CURLMcode multiStat = curl_multi_add_handle(multiHandle, requestHandle);
 	if (multiStat) {
 		fprintf(stderr, "Unexpected curl error: %s.\n", curl_multi_strerror(multiStat));
+		curl_easy_cleanup(requestHandle);
 		return 1;
 	}
+	transferCount++;
 
 	return 0;
 }
 
+static CURLcode
+setConditions(CURL *requestHandle, outputStruct *output)
+{
+	// Send the validators of our copy, and with deltaFeed, ask for only
+	// the items that are new since then.
+
+	struct curl_slist *headers = NULL;
+
+	if (output->etag) {
+		char *line = ecalloc(strlen(output->etag) + 16, sizeof(char));
+		sprintf(line, "If-None-Match: %s", output->etag);
+		headers = curl_slist_append(headers, line);
+		free(line);
+
+		if (output->deltaFeed)
+			headers = curl_slist_append(headers, "A-IM: feed");
+	}
+
+	CURLcode stat;
+	stat = curl_easy_setopt(requestHandle, CURLOPT_HTTPHEADER, headers);
+	stat = curl_easy_setopt(requestHandle, CURLOPT_FILETIME, 1L);
+	stat = curl_easy_setopt(requestHandle, CURLOPT_TIMECONDITION,
+	                        output->modified ? CURL_TIMECOND_IFMODSINCE : CURL_TIMECOND_NONE);
+	stat = curl_easy_setopt(requestHandle, CURLOPT_TIMEVALUE_LARGE, (curl_off_t) output->modified);
+
+	// The previous list is no longer in use once it is replaced.
+	curl_slist_free_all(output->headers);
+	output->headers = headers;
+
+	return stat;
+}
+
+static void
+readConditions(CURL *requestHandle, outputStruct *output)
+{
+	// Keep the validators of a new body.
+
+	if (output->responseCode < 200 || output->responseCode >= 300)
+		return;
+
+	output->partial = output->responseCode == 226;
+
+	struct curl_header *header;
+	free(output->etag);
+	output->etag = NULL;
+
+	if (!curl_easy_header(requestHandle, "ETag", 0, CURLH_HEADER, -1, &header)) {
+		output->etag = ecalloc(strlen(header->value) + 1, sizeof(char));
+		strcpy(output->etag, header->value);
+	}
+
+	curl_off_t modified = -1;
+	curl_easy_getinfo(requestHandle, CURLINFO_FILETIME_T, &modified);
+	output->modified = modified > 0 ? modified : 0;
+}
+
 int
-performRequests(void callback(char *, long))
+createRequest(const char* url, outputStruct *output)
+{
+	// Create the curl request for an URL.
+
+	CURL *requestHandle = initRequest(url, output);
+
+	if (!requestHandle)
+		return 1;
+
+	output->maxSize = maxFeedSize;
+
+	CURLcode stat;
+	stat = curl_easy_setopt(requestHandle, CURLOPT_TIMEOUT, requestTimeout);
+	stat = curl_easy_setopt(requestHandle, CURLOPT_MAXFILESIZE_LARGE, maxFeedSize);
+	if (!stat && output->conditional)
+		stat = setConditions(requestHandle, output);
+
+	if (stat) {
+		fprintf(stderr, "Unexpected curl error: %s.\n", curl_easy_strerror(stat));
+		curl_easy_cleanup(requestHandle);
+		return 1;
+	}
+
+	return addRequest(requestHandle);
+}
+
+int
+createDownload(const char *url, outputStruct *output, const char *range, curl_off_t maxSpeed)
+{
+	// Create a request for a large file, streamed to output->file.
+	// There is no total timeout or size limit, only the low speed limit.
+	// Either resumes at output->offset, or fetches range ("start-end").
+
+	CURL *requestHandle = initRequest(url, output);
+
+	if (!requestHandle)
+		return 1;
+
+	output->maxSize = 0;
+
+	CURLcode stat = CURLE_OK;
+	if (range)
+		stat = curl_easy_setopt(requestHandle, CURLOPT_RANGE, range);
+	else if (output->offset)
+		stat = curl_easy_setopt(requestHandle, CURLOPT_RESUME_FROM_LARGE, output->offset);
+	if (!stat && maxSpeed)
+		stat = curl_easy_setopt(requestHandle, CURLOPT_MAX_RECV_SPEED_LARGE, maxSpeed);
+
+	if (stat) {
+		fprintf(stderr, "Unexpected curl error: %s.\n", curl_easy_strerror(stat));
+		curl_easy_cleanup(requestHandle);
+		return 1;
+	}
+
+	return addRequest(requestHandle);
+}
+
+int
+createHead(const char *url, outputStruct *output)
+{
+	// Create a request for the headers of an URL, to learn the size of
+	// a file before downloading it.
+
+	CURL *requestHandle = initRequest(url, output);
+
+	if (!requestHandle)
+		return 1;
+
+	CURLcode stat;
+	stat = curl_easy_setopt(requestHandle, CURLOPT_NOBODY, 1L);
+	stat = curl_easy_setopt(requestHandle, CURLOPT_TIMEOUT, requestTimeout);
+
+	if (stat) {
+		fprintf(stderr, "Unexpected curl error: %s.\n", curl_easy_strerror(stat));
+		curl_easy_cleanup(requestHandle);
+		return 1;
+	}
+
+	return addRequest(requestHandle);
+}
+
+int
+createPost(const char *url, outputStruct *output, const char *fields)
+{
+	// Create a request that posts form fields (already URL-encoded).
+
+	CURL *requestHandle = initRequest(url, output);
+
+	if (!requestHandle)
+		return 1;
+
+	output->maxSize = maxFeedSize;
+
+	CURLcode stat;
+	stat = curl_easy_setopt(requestHandle, CURLOPT_COPYPOSTFIELDS, fields);
+	stat = curl_easy_setopt(requestHandle, CURLOPT_TIMEOUT, requestTimeout);
+
+	if (stat) {
+		fprintf(stderr, "Unexpected curl error: %s.\n", curl_easy_strerror(stat));
+		curl_easy_cleanup(requestHandle);
+		return 1;
+	}
+
+	return addRequest(requestHandle);
+}
+
+int
+requestFailed(const outputStruct *output)
+{
+	// Returns 0 for bodies and 304 Not Modified.
+
+	return output->result != CURLE_OK ||
+	       ((output->responseCode < 200 || output->responseCode >= 300) &&
+	        output->responseCode != 304);
+}
+
+char *
+urlHost(const char *url, long *port)
+{
+	// Return the host name of url in a new string, or NULL if the URL
+	// can not be parsed. If port is set, it receives the URL's port.
+
+	CURLU *handle = curl_url();
+	char *part = NULL;
+	char *host = NULL;
+
+	if (handle && !curl_url_set(handle, CURLUPART_URL, url, CURLU_NON_SUPPORT_SCHEME) &&
+	    !curl_url_get(handle, CURLUPART_HOST, &part, 0)) {
+		host = ecalloc(strlen(part) + 1, sizeof(char));
+		strcpy(host, part);
+	}
+
+	if (host && port) {
+		curl_free(part);
+		part = NULL;
+		*port = curl_url_get(handle, CURLUPART_PORT, &part, CURLU_DEFAULT_PORT) ? 0 : atol(part);
+	}
+
+	curl_free(part);
+	curl_url_cleanup(handle);
+
+	return host;
+}
+
+void
+catchSignals()
+{
+	// Turn SIGINT and SIGTERM into a request to stop, which transfers and
+	// callers check with stopRequested(), so that the work already done
+	// is saved. Linux only, elsewhere signals keep their default action.
+
+#ifdef __linux__
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+
+	sigprocmask(SIG_BLOCK, &signals, &oldSignals);
+	signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	if (signalFd < 0)
+		sigprocmask(SIG_SETMASK, &oldSignals, NULL);
+#endif // __linux__
+}
+
+int
+stopRequested()
+{
+	// Returns the signal that asked to stop, or 0.
+
+#ifdef __linux__
+	struct signalfd_siginfo info;
+
+	if (!stopSignal && signalFd >= 0 && read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+		stopSignal = info.ssi_signo;
+		logMsg(LOG_ERROR, "Received signal %d, stopping.\n", stopSignal);
+	}
+#endif // __linux__
+
+	return stopSignal;
+}
+
+int
+stopFd()
+{
+	// File descriptor to poll for stop requests, or -1.
+
+#ifdef __linux__
+	return signalFd;
+#else
+	return -1;
+#endif // __linux__
+}
+
+void
+releaseSignals()
+{
+	// Restore the default signal handling. If a signal asked to stop,
+	// raise it again, so that the process ends the way its sender expects.
+
+#ifdef __linux__
+	if (signalFd < 0)
+		return;
+
+	close(signalFd);
+	signalFd = -1;
+	sigprocmask(SIG_SETMASK, &oldSignals, NULL);
+#endif // __linux__
+
+	if (stopSignal) {
+		fflush(NULL);
+		signal(stopSignal, SIG_DFL);
+		raise(stopSignal);
+	}
+}
+
+static void
+dropTransfer(CURL *requestHandle)
+{
+	// Give up on a transfer, which is marked CURLE_ABORTED_BY_CALLBACK.
+
+	outputStruct *output = NULL;
+	long responseCode = 0;
+
+	curl_easy_getinfo(requestHandle, CURLINFO_PRIVATE, (char **)&output);
+	curl_easy_getinfo(requestHandle, CURLINFO_RESPONSE_CODE, &responseCode);
+
+	output->result = CURLE_ABORTED_BY_CALLBACK;
+	if (responseCode)
+		output->responseCode = responseCode;
+
+	curl_easy_cleanup(requestHandle);
+	curl_slist_free_all(output->headers);
+	output->headers = NULL;
+}
+
+static void
+dropTransfers()
+{
+	// Stop every transfer in progress or waiting to be retried.
+
+	if (!transferCount && !retryCount)
+		return;
+
+	logMsg(LOG_ERROR, "Interrupted, skipping unfinished downloads.\n");
+
+#if LIBCURL_VERSION_NUM >= 0x080400
+	CURL **handles = curl_multi_get_handles(multiHandle);
+
+	for (size_t i = 0; handles && handles[i]; i++) {
+		curl_multi_remove_handle(multiHandle, handles[i]);
+		dropTransfer(handles[i]);
+	}
+
+	curl_free(handles);
+#endif // LIBCURL_VERSION_NUM
+	// Older versions of libcurl can not list the transfers, they are
+	// freed with the multi handle.
+	transferCount = 0;
+
+	for (size_t i = 0; i < retryCount; i++)
+		dropTransfer(retries[i].handle);
+	retryCount = 0;
+}
+
+static int
+isTransient(CURLcode result, long responseCode)
+{
+	// Failures that are worth retrying.
+
+	switch (result) {
+		case CURLE_OK:
+			return responseCode == 429 || responseCode == 500 ||
+			       responseCode == 502 || responseCode == 503 ||
+			       responseCode == 504;
+		case CURLE_COULDNT_RESOLVE_HOST:
+		case CURLE_COULDNT_CONNECT:
+		case CURLE_OPERATION_TIMEDOUT:
+		case CURLE_SEND_ERROR:
+		case CURLE_RECV_ERROR:
+		case CURLE_GOT_NOTHING:
+		case CURLE_PARTIAL_FILE:
+		case CURLE_HTTP2:
+		case CURLE_HTTP2_STREAM:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static long long
+retryDelay(CURL *requestHandle, int attempts)
+{
+	// Milliseconds to wait before the next attempt, or -1 to give up.
+
+	long long delay = retryBaseDelay;
+	for (int i = 1; i < attempts && delay < retryMaxDelay; i++)
+		delay *= 2;
+	if (delay > retryMaxDelay)
+		delay = retryMaxDelay;
+
+	// Full jitter in the upper half, so feeds on one host do not retry
+	// in lockstep.
+	delay = delay / 2 + rand() % (delay / 2 + 1);
+
+	curl_off_t retryAfter = 0;
+	curl_easy_getinfo(requestHandle, CURLINFO_RETRY_AFTER, &retryAfter);
+
+	if (retryAfter > 0) {
+		if (retryAfter * 1000 > retryMaxDelay)
+			return -1;
+		if (retryAfter * 1000 > delay)
+			delay = retryAfter * 1000;
+	}
+
+	return delay;
+}
+
+static int
+scheduleRetry(CURL *requestHandle, outputStruct *output)
+{
+	// Returns 1 if the transfer will be attempted again.
+
+	char *url = NULL;
+	curl_easy_getinfo(requestHandle, CURLINFO_EFFECTIVE_URL, &url);
+
+	long long delay = 0;
+	long code = output->responseCode;
+
+	if (output->deltaFeed && output->etag && (code == 400 || code == 406 || code == 501)) {
+		// The server does not understand A-IM: ask for the whole feed.
+		output->deltaFeed = 0;
+		output->deltaRejected = 1;
+		if (setConditions(requestHandle, output))
+			return 0;
+		logMsg(LOG_VERBOSE, "%s does not support delta feeds, fetching it again.\n", url);
+	} else {
+		if (output->attempts > maxRetries || !isTransient(output->result, code))
+			return 0;
+
+		delay = retryDelay(requestHandle, output->attempts);
+		if (delay < 0)
+			return 0;
+
+		logMsg(LOG_VERBOSE, "Retrying %s in %lld ms\n", url, delay);
+		statAdd(STAT_RETRIES, 1);
+	}
+
+	free(output->buffer);
+	output->buffer = NULL;
+	output->size = 0;
+
+	// Start the file over, from where this transfer started writing.
+	if (output->file && !output->positioned) {
+		fflush(output->file);
+		if (ftruncate(fileno(output->file), output->offset) ||
+		        fseek(output->file, output->offset, SEEK_SET))
+			return 0;
+	}
+
+	if (retryCount == retryCap) {
+		retryCap = retryCap ? retryCap * 2 : 16;
+		retries = erealloc(retries, retryCap * sizeof(retryStruct));
+	}
+
+	retries[retryCount].handle = requestHandle;
+	retries[retryCount].due = monoNsec() / 1000000 + delay;
+	retryCount++;
+
+	return 1;
+}
+
+static long
+startRetries()
+{
+	// Restart the transfers that are due.
+	// Returns the milliseconds until the next one, or -1 if there are none.
+
+	long long now = monoNsec() / 1000000;
+	long long next = -1;
+	size_t i = 0;
+
+	while (i < retryCount) {
+		if (retries[i].due <= now) {
+			curl_multi_add_handle(multiHandle, retries[i].handle);
+			transferCount++;
+			retries[i] = retries[--retryCount];
+			continue;
+		}
+
+		if (next < 0 || retries[i].due - now < next)
+			next = retries[i].due - now;
+		i++;
+	}
+
+	return next;
+}
+
+static curl_off_t
+fileSize(CURL *requestHandle, long responseCode)
+{
+	// Size of the whole file a response holds, or a part of.
+
+	if (responseCode == 206) {
+		struct curl_header *header;
+
+		if (curl_easy_header(requestHandle, "Content-Range", 0, CURLH_HEADER, -1, &header))
+			return -1;
+
+		// "bytes [start]-[end]/[size]", with "*" for an unknown size
+		const char *size = strchr(header->value, '/');
+
+		return size && size[1] >= '0' && size[1] <= '9' ? strtoll(size + 1, NULL, 10) : -1;
+	}
+
+	curl_off_t length = -1;
+
+	if (responseCode == 200)
+		curl_easy_getinfo(requestHandle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+
+	return length;
+}
+
+static void
+readMessages(void callback(char *, long))
+{
+	// Handle finished transfers.
+
+	CURLMsg* msg;
+
+	int queueMsgs;
+
+	while ((msg = curl_multi_info_read(multiHandle, &queueMsgs))) {
+		if (msg->msg == CURLMSG_DONE) {
+			CURL *requestHandle = msg->easy_handle;
+			outputStruct *output = NULL;
+
+			char *url = NULL;
+			long responseCode = 0;
+
+			curl_easy_getinfo(requestHandle, CURLINFO_PRIVATE, (char **)&output);
+			curl_easy_getinfo(requestHandle, CURLINFO_EFFECTIVE_URL, &url);
+			curl_easy_getinfo(requestHandle, CURLINFO_RESPONSE_CODE, &responseCode);
+
+			output->result = msg->data.result;
+			output->responseCode = responseCode;
+			output->fileSize = fileSize(requestHandle, responseCode);
+			output->attempts++;
+
+			curl_multi_remove_handle(multiHandle, requestHandle);
+			transferCount--;
+
+			recordDns(requestHandle, output->result);
+
+			if (output->conditional)
+				readConditions(requestHandle, output);
+
+			if (scheduleRetry(requestHandle, output))
+				continue;
+
+			callback(url, responseCode);
+
+			curl_easy_cleanup(requestHandle);
+			curl_slist_free_all(output->headers);
+			output->headers = NULL;
+		}
+	}
+}
+
+static void
+performPoll(void callback(char *, long))
 {
-	// Perform all the curl requests.
+	// Wait on all sockets with curl_multi_poll, then let curl check every
+	// transfer.
 
 	int runningRequests;
+	struct curl_waitfd stop = {
+		.fd = stopFd(),
+		.events = CURL_WAIT_POLLIN,
+	};
 
 	do {
-		curl_multi_wait(multiHandle, NULL, 0, 1000, NULL);
+		long timeout = startRetries();
+		if (timeout < 0 || timeout > 1000)
+			timeout = 1000;
+
+		curl_multi_poll(multiHandle, &stop, stop.fd >= 0, timeout, NULL);
 		curl_multi_perform(multiHandle, &runningRequests);
 
-		CURLMsg* msg;
+		readMessages(callback);
+
+		if (stop.revents && stopRequested()) {
+			dropTransfers();
+			break;
+		}
+
+	// > 0 because curl puts negative numbers when there's broken requests
+	} while (runningRequests > 0 || retryCount);
+}
+
+#ifdef __linux__
+// Milliseconds until curl wants to be called, -1 for no timeout
+static long curlTimeout = -1;
+static int epollFd = -1;
+
+static int
+socketCallback(CURL *easy, curl_socket_t sock, int what, void *data, void *sockData)
+{
+	// Keep the epoll set in sync with the sockets curl is waiting on.
+
+	(void) easy;
+	(void) data;
+
+	if (what == CURL_POLL_REMOVE) {
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, sock, NULL);
+		return 0;
+	}
+
+	struct epoll_event event = {
+		.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0) |
+		          ((what & CURL_POLL_OUT) ? EPOLLOUT : 0),
+		.data.fd = sock,
+	};
+
+	if (sockData) {
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, sock, &event);
+	} else {
+		// Mark the socket as registered
+		curl_multi_assign(multiHandle, sock, &epollFd);
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, sock, &event))
+			epoll_ctl(epollFd, EPOLL_CTL_MOD, sock, &event);
+	}
+
+	return 0;
+}
+
+static int
+timerCallback(CURLM *multi, long timeout, void *data)
+{
+	(void) multi;
+	(void) data;
+
+	curlTimeout = timeout;
 
-		int queueMsgs;
+	return 0;
+}
+
+static int
+performEpoll(void callback(char *, long))
+{
+	// Only service the sockets that have activity, using
+	// curl_multi_socket_action. The same loop handles retry timers and
+	// stop requests, which drop the remaining transfers.
+	// Returns 1 if setting up epoll failed.
+
+	curlTimeout = -1;
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd < 0)
+		return 1;
+
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.fd = signalFd,
+	};
+	if (signalFd >= 0)
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+
+	curl_multi_setopt(multiHandle, CURLMOPT_SOCKETFUNCTION, socketCallback);
+	curl_multi_setopt(multiHandle, CURLMOPT_TIMERFUNCTION, timerCallback);
+
+	int runningRequests;
+	curl_multi_socket_action(multiHandle, CURL_SOCKET_TIMEOUT, 0, &runningRequests);
 
-		while ((msg = curl_multi_info_read(multiHandle, &queueMsgs))) {
-			if (msg->msg == CURLMSG_DONE) {
-				CURL *requestHandle = msg->easy_handle;
+	struct epoll_event events[64];
 
-				char *url = NULL;
-				long responseCode = 0;
+	while (transferCount || retryCount) {
+		long timeout = startRetries();
+		if (timeout < 0 || (curlTimeout >= 0 && curlTimeout < timeout))
+			timeout = curlTimeout;
+		if (timeout < 0 || timeout > 1000)
+			timeout = 1000;
 
-				curl_easy_getinfo(requestHandle, CURLINFO_EFFECTIVE_URL, &url);
-				curl_easy_getinfo(requestHandle, CURLINFO_RESPONSE_CODE, &responseCode);
+		int count = epoll_wait(epollFd, events, LEN(events), timeout);
 
-				callback(url, responseCode);
+		if (count <= 0) {
+			curl_multi_socket_action(multiHandle, CURL_SOCKET_TIMEOUT, 0, &runningRequests);
+		}
+
+		int stop = 0;
+
+		for (int i = 0; i < count; i++) {
+			int fd = events[i].data.fd;
 
-				curl_multi_remove_handle(multiHandle, requestHandle);
-				curl_easy_cleanup(requestHandle);
+			if (fd == signalFd) {
+				stop = stopRequested();
+				continue;
 			}
+
+			int flags = 0;
+			if (events[i].events & EPOLLIN)
+				flags |= CURL_CSELECT_IN;
+			if (events[i].events & EPOLLOUT)
+				flags |= CURL_CSELECT_OUT;
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				flags |= CURL_CSELECT_ERR;
+
+			curl_multi_socket_action(multiHandle, fd, flags, &runningRequests);
 		}
 
-	// > 0 because curl puts negative numbers when there's broken requests
-	} while (runningRequests > 0);
+		readMessages(callback);
 
-	curl_multi_cleanup(multiHandle);
+		if (stop) {
+			dropTransfers();
+			break;
+		}
+	}
+
+	if (signalFd >= 0)
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, signalFd, NULL);
+	close(epollFd);
+
+	return 0;
+}
+#endif // __linux__
+
+int
+performRequests(void callback(char *, long))
+{
+	// Perform all the curl requests. After a stop request, they are
+	// dropped instead.
+
+	if (stopRequested()) {
+		dropTransfers();
+		return 1;
+	}
+
+	struct rusage before, after;
+	getrusage(RUSAGE_SELF, &before);
+	long long start = monoNsec();
+
+#ifdef __linux__
+	if (netDriver != DRIVER_EPOLL || performEpoll(callback))
+		performPoll(callback);
+#else
+	performPoll(callback);
+#endif // __linux__
+
+	getrusage(RUSAGE_SELF, &after);
+
+	long long cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) * 1000000LL +
+	                (after.ru_utime.tv_usec - before.ru_utime.tv_usec) +
+	                (after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1000000LL +
+	                (after.ru_stime.tv_usec - before.ru_stime.tv_usec);
+
+	statAdd(STAT_NET_USEC, (monoNsec() - start) / 1000);
+	statAdd(STAT_NET_CPU_USEC, cpu);
+
+	free(retries);
+	retries = NULL;
+	retryCap = 0;
 
 	return 0;
 }
@@ -10,12 +10,60 @@ You should have received a copy of the GNU General Public License along with thi
 */
 
 #include <curl/curl.h>
+#include <time.h>
 
 typedef struct {
 	char *buffer;
 	size_t size;
+
+	// If set, the body is written to this file instead of buffer,
+	// starting at offset. Unless positioned is set, the file is
+	// written sequentially and offset is only used to resume.
+	FILE *file;
+	curl_off_t offset;
+	int positioned;
+
+	// Bodies larger than this are aborted, 0 for no limit
+	curl_off_t maxSize;
+	// Set if the download was stopped for exceeding maxSize
+	int tooLarge;
+
+	// Set once the request is done, CURLE_ABORTED_BY_CALLBACK if it was
+	// dropped because a stop was requested
+	CURLcode result;
+	long responseCode;
+	int attempts;
+	// Size of the whole file, from Content-Range for 206 responses and
+	// Content-Length for 200 responses, -1 if unknown
+	curl_off_t fileSize;
+
+	// For conditional requests, set before createRequest(): the body is
+	// only sent if it changed since the copy with this ETag (a string the
+	// output owns, or NULL) and modification time (or 0). They are then
+	// replaced by those of the response.
+	int conditional;
+	char *etag;
+	time_t modified;
+	// Ask for only the new items of a feed (RFC 3229 "A-IM: feed"), which
+	// needs an ETag. Cleared, and deltaRejected set, if the server refuses.
+	int deltaFeed;
+	int deltaRejected;
+	// Set if the response only holds the new items (226 IM Used)
+	int partial;
+	struct curl_slist *headers;
 } outputStruct;
 
 int initCurl();
+void cleanupCurl();
+void limitConnections(long total, long perHost);
 int createRequest(const char *url, outputStruct *output);
+int createDownload(const char *url, outputStruct *output, const char *range, curl_off_t maxSpeed);
+int createHead(const char *url, outputStruct *output);
+int createPost(const char *url, outputStruct *output, const char *fields);
 int performRequests(void callback(char *, long));
+int requestFailed(const outputStruct *output);
+char *urlHost(const char *url, long *port);
+void catchSignals();
+int stopRequested();
+int stopFd();
+void releaseSignals();
@@ -0,0 +1,164 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "util.h"
+#include "net.h"
+#include "stats.h"
+#include "prefetch.h"
+
+/*
+	Downloads the linked page of each new article, saved next to it as
+	[article name].page.html. Pages are fetched after the feeds, on the
+	same curl multi handle, with a limit on parallel connections.
+*/
+
+static const char pageExt[] = ".page.html";
+
+typedef struct {
+	char *url;
+	// Final path of the page, and the partial file while downloading
+	char *path;
+	char *partPath;
+	outputStruct output;
+} pageStruct;
+
+static pageStruct *pages;
+static size_t pageCount;
+static size_t pageCap;
+
+static char *
+copyStr(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *copy = ecalloc(len, sizeof(char));
+	memcpy(copy, str, len);
+
+	return copy;
+}
+
+void
+queuePage(const char *url, const char *folder, const char *basename)
+{
+	// Queue the page of a new article, if prefetching is enabled.
+
+	if (!prefetchPages || !url || !url[0])
+		return;
+
+	if (pageCount == pageCap) {
+		pageCap = pageCap ? pageCap * 2 : 64;
+		pages = erealloc(pages, pageCap * sizeof(pageStruct));
+	}
+
+	pageStruct *page = &pages[pageCount++];
+	memset(page, 0, sizeof(pageStruct));
+
+	size_t len = strlen(basename);
+	char *name = ecalloc(len + sizeof(pageExt) + 5, sizeof(char));
+
+	sprintf(name, "%s%s", basename, pageExt);
+	page->path = joinPath(folder, name);
+	sprintf(name, "%s%s.part", basename, pageExt);
+	page->partPath = joinPath(folder, name);
+	page->url = copyStr(url);
+
+	free(name);
+}
+
+void
+removePage(const char *folder, const char *basename)
+{
+	char *name = ecalloc(strlen(basename) + sizeof(pageExt), sizeof(char));
+	sprintf(name, "%s%s", basename, pageExt);
+
+	char *path = joinPath(folder, name);
+	remove(path);
+
+	free(path);
+	free(name);
+}
+
+static void
+pageDone(char *url, long responseCode)
+{
+	logMsg(LOG_VERBOSE, "Fetched page %s (HTTP %ld)\n", url, responseCode);
+}
+
+int
+fetchPages()
+{
+	// Download the queued pages. Returns the number that failed.
+
+	if (!pageCount)
+		return 0;
+
+	int failed = 0;
+	long long start = monoNsec();
+
+	limitConnections(prefetchConnections, prefetchHostConnections);
+
+	for (size_t i = 0; i < pageCount; i++) {
+		pageStruct *page = &pages[i];
+
+		page->output.file = fopen(page->partPath, "wb");
+		if (!page->output.file) {
+			logMsg(LOG_ERROR, "Could not open %s.\n", page->partPath);
+			failed++;
+			continue;
+		}
+
+		if (createRequest(page->url, &page->output)) {
+			logMsg(LOG_ERROR, "Could not fetch page %s.\n", page->url);
+			fclose(page->output.file);
+			page->output.file = NULL;
+			remove(page->partPath);
+			failed++;
+		}
+	}
+
+	performRequests(pageDone);
+
+	for (size_t i = 0; i < pageCount; i++) {
+		pageStruct *page = &pages[i];
+
+		if (page->output.file) {
+			int err = fclose(page->output.file);
+
+			if (err || requestFailed(&page->output) || rename(page->partPath, page->path)) {
+				logMsg(LOG_ERROR, "Could not fetch page %s.\n", page->url);
+				remove(page->partPath);
+				failed++;
+			} else {
+				statAdd(STAT_PAGES, 1);
+				statAdd(STAT_PAGE_BYTES, page->output.size);
+			}
+		}
+
+		free(page->url);
+		free(page->path);
+		free(page->partPath);
+	}
+
+	logMsg(LOG_INFO, "Fetched %zu pages in %.1f ms.\n",
+	       pageCount - failed, (monoNsec() - start) / 1e6);
+
+	free(pages);
+	pages = NULL;
+	pageCount = pageCap = 0;
+
+	limitConnections(0, 0);
+
+	return failed;
+}
@@ -0,0 +1,449 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "util.h"
+#include "stats.h"
+#include "retention.h"
+#include "prefetch.h"
+#include "enclosure.h"
+#include "store.h"
+
+/*
+	Retention limits for feed folders.
+
+	For each feed with limits, .minrss/feeds/[feed].items lists the saved
+	articles oldest first, one "[time] [size] [file name]" line each.
+	Eviction only has to look at the head of this list instead of
+	scanning the feed folder.
+
+	Evicted articles that are still in the feed would otherwise be saved
+	again as new, so .minrss/feeds/[feed].seen keeps the FNV-1a hash of
+	their file names. Hashes of articles that left the feed are dropped.
+*/
+
+typedef struct {
+	time_t time;
+	long size;
+	char *name;
+} entryStruct;
+
+struct retentionStruct {
+	const linkStruct *feed;
+	char *itemsPath;
+	char *seenPath;
+
+	// Sorted hashes of evicted articles
+	uint64_t *seen;
+	size_t seenCount;
+
+	// Hashes to keep in the seen file
+	uint64_t *keep;
+	size_t keepCount;
+	size_t keepCap;
+
+	FILE *items;
+
+	// Set if the feed only holds its new articles, so the others did
+	// not necessarily leave it
+	int partial;
+};
+
+static const linkStruct *
+findFeed(const char *feedName)
+{
+	for (size_t i = 0; i < LEN(links); i++) {
+		if (!strcmp(links[i].feedName, feedName))
+			return &links[i];
+	}
+
+	return NULL;
+}
+
+static int
+cmpHashes(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static int
+cmpEntries(const void *a, const void *b)
+{
+	const entryStruct *x = a;
+	const entryStruct *y = b;
+
+	return (x->time > y->time) - (x->time < y->time);
+}
+
+static void
+keepHash(retentionStruct *ret, uint64_t hash)
+{
+	if (ret->keepCount == ret->keepCap) {
+		ret->keepCap = ret->keepCap ? ret->keepCap * 2 : 64;
+		ret->keep = erealloc(ret->keep, ret->keepCap * sizeof(uint64_t));
+	}
+
+	ret->keep[ret->keepCount++] = hash;
+}
+
+static void
+loadSeen(retentionStruct *ret)
+{
+	FILE *f = fopen(ret->seenPath, "r");
+	if (!f)
+		return;
+
+	size_t cap = 0;
+	unsigned long long hash;
+
+	while (fscanf(f, "%llx", &hash) == 1) {
+		if (ret->seenCount == cap) {
+			cap = cap ? cap * 2 : 64;
+			ret->seen = erealloc(ret->seen, cap * sizeof(uint64_t));
+		}
+		ret->seen[ret->seenCount++] = hash;
+	}
+
+	fclose(f);
+
+	qsort(ret->seen, ret->seenCount, sizeof(uint64_t), cmpHashes);
+}
+
+static int
+isCompanion(const char *name)
+{
+	// Files saved along with an article, evicted with it.
+
+	size_t len = strlen(name);
+	size_t extLen = strlen(".page.html");
+
+	return (len > extLen && !strcmp(name + len - extLen, ".page.html")) ||
+	       isEnclosure(name);
+}
+
+static void
+removeCompanions(const char *folder, const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	size_t len = ext ? (size_t) (ext - name) : strlen(name);
+
+	char *basename = ecalloc(len + 1, sizeof(char));
+	memcpy(basename, name, len);
+
+	removePage(folder, basename);
+	removeEnclosure(folder, basename);
+
+	free(basename);
+}
+
+static void
+seedItems(retentionStruct *ret)
+{
+	// Build the list from the feed folder the first time limits are used.
+
+	DIR *d = opendir(ret->feed->feedName);
+	if (!d)
+		return;
+
+	entryStruct *entries = NULL;
+	size_t count = 0, cap = 0;
+	struct dirent *ent;
+
+	while ((ent = readdir(d))) {
+		struct stat st;
+		char *path = joinPath(ret->feed->feedName, ent->d_name);
+		int err = stat(path, &st);
+		free(path);
+
+		if (err || !S_ISREG(st.st_mode) || isCompanion(ent->d_name))
+			continue;
+
+		if (count == cap) {
+			cap = cap ? cap * 2 : 64;
+			entries = erealloc(entries, cap * sizeof(entryStruct));
+		}
+
+		// d_name is only valid until the next readdir()
+		size_t len = strlen(ent->d_name);
+		entries[count].name = ecalloc(len + 1, sizeof(char));
+		memcpy(entries[count].name, ent->d_name, len);
+		entries[count].time = st.st_mtime;
+		entries[count].size = st.st_size;
+		count++;
+	}
+
+	closedir(d);
+
+	qsort(entries, count, sizeof(entryStruct), cmpEntries);
+
+	for (size_t i = 0; i < count; i++) {
+		fprintf(ret->items, "%lld %ld %s\n",
+		        (long long) entries[i].time, entries[i].size, entries[i].name);
+		free(entries[i].name);
+	}
+
+	free(entries);
+}
+
+retentionStruct *
+openRetention(const char *feedName, int partial)
+{
+	// Returns NULL if the feed has no retention limits.
+	// Set partial if only the new articles of the feed will be processed.
+
+	const linkStruct *feed = findFeed(feedName);
+
+	if (!feed || !(feed->maxItems || feed->maxAge || feed->maxBytes))
+		return NULL;
+
+	char *feedsDir = joinPath(stateDir, "feeds");
+
+	if (makeDir(stateDir) || makeDir(feedsDir)) {
+		free(feedsDir);
+		return NULL;
+	}
+
+	retentionStruct *ret = ecalloc(1, sizeof(retentionStruct));
+	ret->feed = feed;
+	ret->partial = partial;
+
+	size_t len = strlen(feedName);
+	char *name = ecalloc(len + 7, sizeof(char));
+
+	sprintf(name, "%s.items", feedName);
+	ret->itemsPath = joinPath(feedsDir, name);
+	sprintf(name, "%s.seen", feedName);
+	ret->seenPath = joinPath(feedsDir, name);
+
+	free(name);
+	free(feedsDir);
+
+	struct stat st;
+	int seed = stat(ret->itemsPath, &st);
+
+	ret->items = fopen(ret->itemsPath, "a");
+	if (!ret->items) {
+		logMsg(LOG_ERROR, "Could not open %s.\n", ret->itemsPath);
+	} else if (seed) {
+		seedItems(ret);
+	}
+
+	loadSeen(ret);
+
+	return ret;
+}
+
+int
+skipItem(retentionStruct *ret, const char *fileName)
+{
+	// Returns 1 if the article was already evicted.
+
+	if (!ret || !ret->seenCount)
+		return 0;
+
+	uint64_t hash = fnv1a(fileName, strlen(fileName));
+
+	if (!bsearch(&hash, ret->seen, ret->seenCount, sizeof(uint64_t), cmpHashes))
+		return 0;
+
+	keepHash(ret, hash);
+
+	return 1;
+}
+
+void
+recordItem(retentionStruct *ret, const char *fileName, long size)
+{
+	if (!ret || !ret->items)
+		return;
+
+	fprintf(ret->items, "%lld %ld %s\n", (long long) time(NULL), size, fileName);
+}
+
+static entryStruct *
+readItems(retentionStruct *ret, size_t *count)
+{
+	FILE *f = fopen(ret->itemsPath, "r");
+	if (!f)
+		return NULL;
+
+	entryStruct *entries = NULL;
+	size_t cap = 0;
+	char *line = NULL;
+	size_t lineCap = 0;
+	ssize_t len;
+
+	*count = 0;
+
+	while ((len = getline(&line, &lineCap, f)) > 0) {
+		long long t;
+		long size;
+		int nameStart;
+
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (sscanf(line, "%lld %ld %n", &t, &size, &nameStart) != 2 || !line[nameStart])
+			continue;
+
+		if (*count == cap) {
+			cap = cap ? cap * 2 : 64;
+			entries = erealloc(entries, cap * sizeof(entryStruct));
+		}
+
+		size_t nameLen = len - nameStart;
+		entries[*count].time = t;
+		entries[*count].size = size;
+		entries[*count].name = ecalloc(nameLen + 1, sizeof(char));
+		memcpy(entries[*count].name, line + nameStart, nameLen);
+		(*count)++;
+	}
+
+	free(line);
+	fclose(f);
+
+	return entries;
+}
+
+static size_t
+evict(retentionStruct *ret)
+{
+	// Remove the oldest articles until the feed is within its limits.
+	// Returns the number of evicted articles.
+
+	const linkStruct *feed = ret->feed;
+	size_t count;
+	entryStruct *entries = readItems(ret, &count);
+
+	if (!entries)
+		return 0;
+
+	unsigned long long bytes = 0;
+	for (size_t i = 0; i < count; i++)
+		bytes += entries[i].size;
+
+	time_t cutoff = time(NULL) - feed->maxAge;
+	size_t first = 0;
+
+	while (first < count &&
+	       ((feed->maxItems && count - first > feed->maxItems) ||
+	        (feed->maxBytes && bytes > feed->maxBytes) ||
+	        (feed->maxAge && entries[first].time < cutoff))) {
+		entryStruct *e = &entries[first];
+		char *path = joinPath(feed->feedName, e->name);
+
+		releaseArticle(path);
+		if (remove(path))
+			logMsg(LOG_VERBOSE, "Could not evict %s.\n", path);
+		else
+			logMsg(LOG_VERBOSE, "Evicted %s.\n", path);
+		removeCompanions(feed->feedName, e->name);
+
+		keepHash(ret, fnv1a(e->name, strlen(e->name)));
+		bytes -= e->size;
+		statAdd(STAT_EVICTED_ITEMS, 1);
+		statAdd(STAT_EVICTED_BYTES, e->size);
+
+		free(path);
+		first++;
+	}
+
+	if (first) {
+		size_t len = strlen(ret->itemsPath);
+		char *tmpPath = ecalloc(len + 5, sizeof(char));
+		sprintf(tmpPath, "%s.tmp", ret->itemsPath);
+
+		FILE *f = fopen(tmpPath, "w");
+		if (f) {
+			for (size_t i = first; i < count; i++)
+				fprintf(f, "%lld %ld %s\n",
+				        (long long) entries[i].time, entries[i].size, entries[i].name);
+			if (fclose(f) || rename(tmpPath, ret->itemsPath))
+				logMsg(LOG_ERROR, "Could not update %s.\n", ret->itemsPath);
+		}
+
+		free(tmpPath);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		free(entries[i].name);
+	free(entries);
+
+	return first;
+}
+
+void
+closeRetention(retentionStruct *ret)
+{
+	// Enforce the limits after a feed's articles were saved.
+
+	if (!ret)
+		return;
+
+	if (ret->items)
+		fclose(ret->items);
+
+	if (ret->partial) {
+		ret->keepCount = 0;
+		for (size_t i = 0; i < ret->seenCount; i++)
+			keepHash(ret, ret->seen[i]);
+	}
+
+	size_t evicted = evict(ret);
+
+	// Rewrite the seen file if articles were evicted or left the feed.
+	// A file cut short would let evicted articles be saved again.
+	if (evicted || ret->keepCount != ret->seenCount) {
+		size_t len = strlen(ret->seenPath);
+		char *tmpPath = ecalloc(len + 5, sizeof(char));
+		sprintf(tmpPath, "%s.tmp", ret->seenPath);
+
+		FILE *f = fopen(tmpPath, "w");
+
+		if (f) {
+			for (size_t i = 0; i < ret->keepCount; i++)
+				fprintf(f, "%016llx\n", (unsigned long long) ret->keep[i]);
+		}
+
+		if (!f || fclose(f) || rename(tmpPath, ret->seenPath)) {
+			logMsg(LOG_ERROR, "Could not write %s.\n", ret->seenPath);
+			remove(tmpPath);
+		}
+
+		free(tmpPath);
+	}
+
+	free(ret->itemsPath);
+	free(ret->seenPath);
+	free(ret->seen);
+	free(ret->keep);
+	free(ret);
+}
+
+void
+checkRetention(const char *feedName)
+{
+	// Enforce the limits of a feed that was not parsed, so that maxAge
+	// still applies while it does not change.
+
+	closeRetention(openRetention(feedName, 1));
+}
@@ -0,0 +1,18 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+typedef struct retentionStruct retentionStruct;
+
+retentionStruct *openRetention(const char *feedName, int partial);
+int skipItem(retentionStruct *ret, const char *fileName);
+void recordItem(retentionStruct *ret, const char *fileName, long size);
+void closeRetention(retentionStruct *ret);
+void checkRetention(const char *feedName);
@@ -0,0 +1,106 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "util.h"
+#include "state.h"
+
+/*
+	Per-feed state kept between runs in .minrss/feeds/[feed].state, as
+	"[key] [value]" lines. Unknown keys are ignored.
+*/
+
+static char *
+statePath(const char *feedName)
+{
+	char *feedsDir = joinPath(stateDir, "feeds");
+	char *name = ecalloc(strlen(feedName) + 7, sizeof(char));
+
+	sprintf(name, "%s.state", feedName);
+	char *path = joinPath(feedsDir, name);
+
+	free(name);
+	free(feedsDir);
+
+	return path;
+}
+
+int
+loadState(const char *feedName, feedStateStruct *state)
+{
+	// Returns 1 if there is no saved state, leaving state zeroed.
+
+	memset(state, 0, sizeof(feedStateStruct));
+
+	char *path = statePath(feedName);
+	FILE *f = fopen(path, "r");
+	free(path);
+
+	if (!f)
+		return 1;
+
+	char key[32];
+	char value[MAX_ETAG];
+
+	while (fscanf(f, "%31s %255s", key, value) == 2) {
+		if (!strcmp(key, "failures"))
+			state->failures = strtoul(value, NULL, 10);
+		else if (!strcmp(key, "retry"))
+			state->retryAt = strtoll(value, NULL, 10);
+		else if (!strcmp(key, "etag"))
+			strcpy(state->etag, value);
+		else if (!strcmp(key, "modified"))
+			state->modified = strtoll(value, NULL, 10);
+		else if (!strcmp(key, "nodelta"))
+			state->noDelta = atoi(value);
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+int
+saveState(const char *feedName, const feedStateStruct *state)
+{
+	char *feedsDir = joinPath(stateDir, "feeds");
+	int err = makeDir(stateDir) || makeDir(feedsDir);
+	free(feedsDir);
+
+	if (err)
+		return 1;
+
+	char *path = statePath(feedName);
+	FILE *f = fopen(path, "w");
+
+	if (!f) {
+		logMsg(LOG_ERROR, "Could not write %s.\n", path);
+		free(path);
+		return 1;
+	}
+
+	fprintf(f, "failures %lu\n", state->failures);
+	fprintf(f, "retry %lld\n", (long long) state->retryAt);
+	if (state->etag[0])
+		fprintf(f, "etag %s\n", state->etag);
+	fprintf(f, "modified %lld\n", (long long) state->modified);
+	fprintf(f, "nodelta %d\n", state->noDelta);
+
+	fclose(f);
+	free(path);
+
+	return 0;
+}
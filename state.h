@@ -0,0 +1,28 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#define MAX_ETAG 256
+
+typedef struct {
+	// Consecutive updates that failed
+	unsigned long failures;
+	// Do not poll the feed before this time
+	time_t retryAt;
+
+	// Validators of the last version saved, for conditional requests
+	char etag[MAX_ETAG];
+	time_t modified;
+	// Set if the server rejected RFC 3229 delta requests
+	int noDelta;
+} feedStateStruct;
+
+int loadState(const char *feedName, feedStateStruct *state);
+int saveState(const char *feedName, const feedStateStruct *state);
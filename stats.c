@@ -0,0 +1,79 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "util.h"
+#include "stats.h"
+
+// Counters collected over a single run, printed at LOG_INFO when it ends.
+
+static long long counters[STAT_END];
+
+static const char *statNames[STAT_END] = {
+	[STAT_INDEX_ITEMS] = "index_items",
+	[STAT_INDEX_NSEC] = "index_nsec",
+	[STAT_EVICTED_ITEMS] = "evicted_items",
+	[STAT_EVICTED_BYTES] = "evicted_bytes",
+	[STAT_RETRIES] = "retries",
+	[STAT_FAILED_FEEDS] = "failed_feeds",
+	[STAT_BREAKER_SKIPS] = "breaker_skips",
+	[STAT_NET_USEC] = "net_usec",
+	[STAT_NET_CPU_USEC] = "net_cpu_usec",
+	[STAT_LIMIT_SIZE] = "limit_size",
+	[STAT_LIMIT_ITEMS] = "limit_items",
+	[STAT_LIMIT_FIELD] = "limit_field",
+	[STAT_LIMIT_PARSE_TIME] = "limit_parse_time",
+	[STAT_PAGES] = "pages",
+	[STAT_PAGE_BYTES] = "page_bytes",
+	[STAT_ENCLOSURES] = "enclosures",
+	[STAT_ENCLOSURES_RESUMED] = "enclosures_resumed",
+	[STAT_ENCLOSURE_BYTES] = "enclosure_bytes",
+	[STAT_DNS_HITS] = "dns_hits",
+	[STAT_DNS_SAVED_USEC] = "dns_saved_usec",
+	[STAT_DNS_LOOKUPS] = "dns_lookups",
+	[STAT_DNS_LOOKUP_USEC] = "dns_lookup_usec",
+	[STAT_DNS_PREFETCHES] = "dns_prefetches",
+	[STAT_PUSHES] = "pushes",
+	[STAT_PUSH_BYTES] = "push_bytes",
+	[STAT_DEDUP_ITEMS] = "dedup_items",
+	[STAT_DEDUP_BYTES] = "dedup_bytes",
+	[STAT_STORE_PRUNED] = "store_pruned",
+};
+
+void
+statAdd(enum stats stat, long long n)
+{
+	counters[stat] += n;
+}
+
+long long
+statGet(enum stats stat)
+{
+	return counters[stat];
+}
+
+void
+printStats()
+{
+	for (int i = 0; i < STAT_END; i++) {
+		if (counters[i])
+			logMsg(LOG_INFO, "stat %s %lld\n", statNames[i], counters[i]);
+	}
+}
+
+void
+resetStats()
+{
+	memset(counters, 0, sizeof(counters));
+}
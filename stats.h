@@ -0,0 +1,48 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+enum stats {
+	STAT_INDEX_ITEMS,
+	STAT_INDEX_NSEC,
+	STAT_EVICTED_ITEMS,
+	STAT_EVICTED_BYTES,
+	STAT_RETRIES,
+	STAT_FAILED_FEEDS,
+	STAT_BREAKER_SKIPS,
+	STAT_NET_USEC,
+	STAT_NET_CPU_USEC,
+	STAT_LIMIT_SIZE,
+	STAT_LIMIT_ITEMS,
+	STAT_LIMIT_FIELD,
+	STAT_LIMIT_PARSE_TIME,
+	STAT_PAGES,
+	STAT_PAGE_BYTES,
+	STAT_ENCLOSURES,
+	STAT_ENCLOSURES_RESUMED,
+	STAT_ENCLOSURE_BYTES,
+	STAT_DNS_HITS,
+	STAT_DNS_SAVED_USEC,
+	STAT_DNS_LOOKUPS,
+	STAT_DNS_LOOKUP_USEC,
+	STAT_DNS_PREFETCHES,
+	STAT_PUSHES,
+	STAT_PUSH_BYTES,
+	STAT_DEDUP_ITEMS,
+	STAT_DEDUP_BYTES,
+	STAT_STORE_PRUNED,
+
+	STAT_END
+};
+
+void statAdd(enum stats stat, long long n);
+long long statGet(enum stats stat);
+void printStats();
+void resetStats();
@@ -0,0 +1,434 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "util.h"
+#include "stats.h"
+#include "store.h"
+
+/*
+	Content-addressed store for articles that appear in several feeds.
+
+	Each article file is kept once in .minrss/store/[xx]/[hash], named
+	after a hash of its contents, and hard linked into every feed folder
+	that has it. Files with the same hash are compared before sharing
+	them, so a collision only costs a copy.
+
+	A copy is only shared between articles with the same link or GUID and
+	title, so .minrss/store/keys lists a hash of those, normalized, with
+	the hash of each copy saved for them, one "[key] [hash]" line each.
+	Articles whose contents differ, such as a summary and the full text,
+	get copies of their own.
+
+	Articles evicted from a feed are noted by releaseArticle(), and once
+	only the store's link to them is left, pruneStore() deletes them.
+	Articles deleted by hand are not noticed, and stay in the store.
+*/
+
+typedef struct {
+	uint64_t key;
+	uint64_t hash;
+} keyStruct;
+
+typedef struct {
+	uint64_t hash;
+	ino_t ino;
+} releasedStruct;
+
+// Keys read from the keys file, sorted, and the ones added since
+static keyStruct *keys;
+static size_t keyCount;
+static size_t keyCap;
+static size_t savedKeys;
+static int keysLoaded;
+
+static releasedStruct *released;
+static size_t releasedCount;
+
+static char *
+storePath(uint64_t hash)
+{
+	// Returns the path for a hash, after creating its folder.
+
+	char name[32];
+	char *storeDir = joinPath(stateDir, "store");
+
+	sprintf(name, "%02x", (unsigned) (hash >> 56));
+	char *dir = joinPath(storeDir, name);
+
+	int err = makeDir(stateDir) || makeDir(storeDir) || makeDir(dir);
+	free(storeDir);
+
+	if (err) {
+		free(dir);
+		return NULL;
+	}
+
+	sprintf(name, "%016llx", (unsigned long long) hash);
+	char *path = joinPath(dir, name);
+	free(dir);
+
+	return path;
+}
+
+static int
+sameContents(const char *path, const char *data, size_t len)
+{
+	// Returns 1 if the file holds exactly data.
+
+	struct stat st;
+	if (stat(path, &st) || (size_t) st.st_size != len)
+		return 0;
+
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return 0;
+
+	char buf[8192];
+	size_t pos = 0, n;
+	int same = 1;
+
+	while (same && (n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		same = pos + n <= len && !memcmp(buf, data + pos, n);
+		pos += n;
+	}
+
+	fclose(f);
+
+	return same && pos == len;
+}
+
+static int
+writeFile(const char *path, const char *data, size_t len)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f)
+		return 1;
+
+	size_t written = fwrite(data, 1, len, f);
+	int err = fclose(f);
+
+	return err || written != len;
+}
+
+static int
+cmpKeys(const void *a, const void *b)
+{
+	const keyStruct *x = a;
+	const keyStruct *y = b;
+
+	if (x->key != y->key)
+		return (x->key > y->key) - (x->key < y->key);
+
+	return (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+static char *
+keysPath()
+{
+	char *storeDir = joinPath(stateDir, "store");
+	char *path = joinPath(storeDir, "keys");
+	free(storeDir);
+
+	return path;
+}
+
+static size_t
+readKeys(keyStruct **list)
+{
+	// Read the keys file into a list. Returns its length.
+
+	char *path = keysPath();
+	FILE *f = fopen(path, "r");
+	free(path);
+
+	if (!f)
+		return 0;
+
+	size_t count = 0, cap = 0;
+	unsigned long long key, hash;
+
+	while (fscanf(f, "%16llx %16llx\n", &key, &hash) == 2) {
+		if (count == cap) {
+			cap = cap ? cap * 2 : 256;
+			*list = erealloc(*list, cap * sizeof(keyStruct));
+		}
+		(*list)[count].key = key;
+		(*list)[count++].hash = hash;
+	}
+
+	fclose(f);
+
+	return count;
+}
+
+static int
+hasKey(uint64_t key, uint64_t hash)
+{
+	// Returns 1 if the copy with this hash was saved for the key.
+
+	if (!keysLoaded) {
+		keyCount = keyCap = savedKeys = readKeys(&keys);
+		qsort(keys, keyCount, sizeof(keyStruct), cmpKeys);
+		keysLoaded = 1;
+	}
+
+	keyStruct find = { .key = key, .hash = hash };
+
+	if (bsearch(&find, keys, savedKeys, sizeof(keyStruct), cmpKeys))
+		return 1;
+
+	// The keys added in this run are few, and not sorted yet.
+	for (size_t i = savedKeys; i < keyCount; i++) {
+		if (keys[i].key == key && keys[i].hash == hash)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void
+addKey(uint64_t key, uint64_t hash)
+{
+	if (hasKey(key, hash))
+		return;
+
+	if (keyCount == keyCap) {
+		keyCap = keyCap ? keyCap * 2 : 256;
+		keys = erealloc(keys, keyCap * sizeof(keyStruct));
+	}
+
+	keys[keyCount].key = key;
+	keys[keyCount++].hash = hash;
+}
+
+static uint64_t
+hashKey(const char *id, const char *title)
+{
+	// Hash an article's link or GUID, in a form that does not depend on
+	// the feed that gave it, together with its title. The title keeps
+	// apart the articles of feeds that give them all the same link.
+
+	while (isspace((unsigned char) *id))
+		id++;
+
+	size_t len = strcspn(id, "#");
+	while (len && (isspace((unsigned char) id[len - 1]) || id[len - 1] == '/'))
+		len--;
+
+	char *norm = ecalloc(len + strlen(title) + 2, sizeof(char));
+	size_t start = 0;
+
+	// http and https give the same article, and the host is case
+	// insensitive.
+	if (!strncasecmp(id, "http://", 7))
+		start = 7;
+	else if (!strncasecmp(id, "https://", 8))
+		start = 8;
+
+	size_t hostEnd = start ? start + strcspn(id + start, "/?") : 0;
+	size_t n = 0;
+
+	for (size_t i = start; i < len; i++)
+		norm[n++] = i < hostEnd ? tolower((unsigned char) id[i]) : id[i];
+
+	norm[n++] = '\n';
+	strcpy(norm + n, title);
+
+	uint64_t key = hash64(norm, strlen(norm));
+	free(norm);
+
+	return key;
+}
+
+int
+storeArticle(const char *path, const char *data, size_t len, const char *id, const char *title)
+{
+	// Save an article at path, as a link to the stored copy if one holds
+	// the same data and was saved for the same link or GUID (id) and
+	// title, which may be NULL. path must not exist. Returns 1 on error.
+
+	uint64_t key = id && id[0] ? hashKey(id, title ? title : "") : 0;
+	uint64_t hash = hash64(data, len);
+	char *shared = storePath(hash);
+	int err = 1;
+
+	if (!shared)
+		return writeFile(path, data, len);
+
+	if (sameContents(shared, data, len)) {
+		// A copy saved for another article is not shared.
+		if (!key || hasKey(key, hash))
+			err = link(shared, path);
+		if (!err) {
+			statAdd(STAT_DEDUP_ITEMS, 1);
+			statAdd(STAT_DEDUP_BYTES, len);
+		}
+	} else if (access(shared, F_OK)) {
+		// Write the new copy under a temporary name, so that no other
+		// process sees it half written.
+		char *tmpPath = ecalloc(strlen(shared) + 32, sizeof(char));
+		sprintf(tmpPath, "%s.tmp-%ld", shared, (long) getpid());
+
+		if (!writeFile(tmpPath, data, len)) {
+			if (!link(tmpPath, shared) || (errno == EEXIST && sameContents(shared, data, len)))
+				err = link(shared, path);
+		}
+
+		remove(tmpPath);
+		free(tmpPath);
+	}
+
+	if (!err && key)
+		addKey(key, hash);
+
+	// On a hash collision, a different key, or a file system without hard
+	// links, the article is not shared.
+	if (err)
+		err = writeFile(path, data, len);
+
+	free(shared);
+
+	return err;
+}
+
+void
+releaseArticle(const char *path)
+{
+	// Note an article that is about to be deleted, so that pruneStore()
+	// checks whether its stored copy is still used.
+
+	struct stat st;
+
+	if (!dedupArticles || stat(path, &st) || st.st_nlink < 2)
+		return;
+
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return;
+
+	char *data = ecalloc(st.st_size + 1, sizeof(char));
+	size_t len = fread(data, 1, st.st_size, f);
+	fclose(f);
+
+	released = erealloc(released, (releasedCount + 1) * sizeof(releasedStruct));
+	released[releasedCount].hash = hash64(data, len);
+	released[releasedCount++].ino = st.st_ino;
+
+	free(data);
+}
+
+static int
+isPruned(const uint64_t *pruned, size_t count, uint64_t hash)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (pruned[i] == hash)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void
+saveKeys(const uint64_t *pruned, size_t prunedCount)
+{
+	// Append the new keys to the keys file, or rewrite it without the
+	// keys of pruned copies. It is read again first, as other processes
+	// may have added keys.
+
+	if (savedKeys == keyCount && !prunedCount)
+		return;
+
+	char *path = keysPath();
+
+	if (!prunedCount) {
+		FILE *f = fopen(path, "a");
+
+		for (size_t i = savedKeys; f && i < keyCount; i++)
+			fprintf(f, "%016llx %016llx\n", (unsigned long long) keys[i].key,
+			        (unsigned long long) keys[i].hash);
+
+		if (!f || fclose(f))
+			logMsg(LOG_ERROR, "Could not write %s.\n", path);
+	} else {
+		keyStruct *list = NULL;
+		size_t count = readKeys(&list);
+
+		char *tmpPath = ecalloc(strlen(path) + 32, sizeof(char));
+		sprintf(tmpPath, "%s.tmp-%ld", path, (long) getpid());
+		FILE *f = fopen(tmpPath, "w");
+
+		for (size_t i = 0; f && i < count + keyCount - savedKeys; i++) {
+			keyStruct *k = i < count ? &list[i] : &keys[savedKeys + i - count];
+
+			if (!isPruned(pruned, prunedCount, k->hash))
+				fprintf(f, "%016llx %016llx\n", (unsigned long long) k->key,
+				        (unsigned long long) k->hash);
+		}
+
+		if (!f || fclose(f) || rename(tmpPath, path)) {
+			logMsg(LOG_ERROR, "Could not write %s.\n", path);
+			remove(tmpPath);
+		}
+
+		free(tmpPath);
+		free(list);
+	}
+
+	free(path);
+
+	// Read the file again when a key is next needed.
+	free(keys);
+	keys = NULL;
+	keyCount = keyCap = savedKeys = 0;
+	keysLoaded = 0;
+}
+
+void
+pruneStore()
+{
+	// Delete the stored copies of the released articles that no feed
+	// links to anymore, then save the keys.
+
+	uint64_t *pruned = ecalloc(releasedCount + 1, sizeof(uint64_t));
+	size_t prunedCount = 0;
+
+	for (size_t i = 0; i < releasedCount; i++) {
+		char *path = storePath(released[i].hash);
+		struct stat st;
+
+		// The inode tells the stored copy from a colliding file.
+		if (path && !stat(path, &st) && st.st_ino == released[i].ino &&
+		        st.st_nlink == 1 && !remove(path)) {
+			statAdd(STAT_STORE_PRUNED, 1);
+			pruned[prunedCount++] = released[i].hash;
+		}
+
+		free(path);
+	}
+
+	saveKeys(pruned, prunedCount);
+
+	free(pruned);
+	free(released);
+	released = NULL;
+	releasedCount = 0;
+}
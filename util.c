@@ -14,26 +14,126 @@ You should have received a copy of the GNU General Public License along with thi
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "config.h"
+#include "util.h"
+
+// Current log level, from logLevel or '-l'
+int curLogLevel = LOG_OUTPUT;
+
+static int curLogFormat = LOG_FORMAT_TEXT;
+static const char *logFeed;
+static long long logStart;
+
+static const char *levelNames[] = {
+	[LOG_FATAL] = "fatal",
+	[LOG_ERROR] = "error",
+	[LOG_OUTPUT] = "output",
+	[LOG_INFO] = "info",
+	[LOG_VERBOSE] = "verbose",
+};
+
+void
+initLog()
+{
+	// stderr is unbuffered by default, which makes verbose logging
+	// cost a system call per message. Errors are still flushed at once.
+	setvbuf(stderr, NULL, _IOFBF, 1 << 16);
+
+	curLogLevel = logLevel;
+	curLogFormat = logFormat;
+	logStart = monoNsec();
+}
+
+int
+setLogLevel(const char *name)
+{
+	// Accepts a level name or number. Returns 1 if it is invalid.
+
+	for (int i = 0; i < (int) LEN(levelNames); i++) {
+		if (!strcmp(name, levelNames[i]) || (name[0] == '0' + i && !name[1])) {
+			curLogLevel = i;
+			return 0;
+		}
+	}
+
+	return 1;
+}
 
 void
-logMsg(int lvl, char *msg, ...)
+setLogFormat(int format)
 {
+	curLogFormat = format;
+}
+
+void
+setLogFeed(const char *feedName)
+{
+	// Feed that following messages are about, or NULL.
+
+	logFeed = feedName;
+}
+
+static void
+putJsonString(FILE *f, const char *str)
+{
+	fputc('"', f);
+
+	for (const unsigned char *c = (const unsigned char *) str; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(f, "\\%c", *c);
+		else if (*c == '\n')
+			fputs("\\n", f);
+		else if (*c < 0x20)
+			fprintf(f, "\\u%04x", *c);
+		else
+			fputc(*c, f);
+	}
+
+	fputc('"', f);
+}
+
+void
+logWrite(int lvl, char *msg, ...)
+{
+	// Use logMsg() instead, which skips disabled levels.
+
 	va_list args;
 	va_start(args, msg);
 
-	if (lvl <= logLevel) {
-		if (lvl == LOG_OUTPUT) {
-			vfprintf(stdout, msg, args);
-		} else {
-			fprintf(stderr, "minrss: ");
-			vfprintf(stderr, msg, args);
+	if (lvl == LOG_OUTPUT) {
+		vfprintf(stdout, msg, args);
+	} else if (curLogFormat == LOG_FORMAT_JSON) {
+		char text[1024];
+		int len = vsnprintf(text, sizeof(text), msg, args);
+
+		if (len > 0 && len < (int) sizeof(text) && text[len - 1] == '\n')
+			text[len - 1] = '\0';
+
+		fprintf(stderr, "{\"time\":%lld,\"elapsed_ms\":%.3f,\"level\":\"%s\"",
+		        (long long) time(NULL), (monoNsec() - logStart) / 1e6, levelNames[lvl]);
+		if (logFeed) {
+			fputs(",\"feed\":", stderr);
+			putJsonString(stderr, logFeed);
 		}
+		fputs(",\"msg\":", stderr);
+		putJsonString(stderr, text);
+		fputs("}\n", stderr);
+	} else {
+		fprintf(stderr, "minrss: ");
+		vfprintf(stderr, msg, args);
 	}
 
 	va_end(args);
 
+	if (lvl <= LOG_ERROR)
+		fflush(stderr);
+
 	if (!lvl)
 		exit(1);
 }
@@ -60,37 +160,329 @@ erealloc(void *p, size_t size)
 	return p;
 }
 
+enum nameClasses {
+	// Dropped from file names
+	NAME_DROP,
+	// Copied as is
+	NAME_KEEP,
+	// Copied, except at the start of the name
+	NAME_DOT,
+	// Start of a UTF-8 sequence
+	NAME_UTF8,
+};
+
+// Class of each byte in a title, for sanitize()
+static const unsigned char nameTable[256] = {
+	['a'] = NAME_KEEP, ['b'] = NAME_KEEP, ['c'] = NAME_KEEP, ['d'] = NAME_KEEP,
+	['e'] = NAME_KEEP, ['f'] = NAME_KEEP, ['g'] = NAME_KEEP, ['h'] = NAME_KEEP,
+	['i'] = NAME_KEEP, ['j'] = NAME_KEEP, ['k'] = NAME_KEEP, ['l'] = NAME_KEEP,
+	['m'] = NAME_KEEP, ['n'] = NAME_KEEP, ['o'] = NAME_KEEP, ['p'] = NAME_KEEP,
+	['q'] = NAME_KEEP, ['r'] = NAME_KEEP, ['s'] = NAME_KEEP, ['t'] = NAME_KEEP,
+	['u'] = NAME_KEEP, ['v'] = NAME_KEEP, ['w'] = NAME_KEEP, ['x'] = NAME_KEEP,
+	['y'] = NAME_KEEP, ['z'] = NAME_KEEP,
+	['A'] = NAME_KEEP, ['B'] = NAME_KEEP, ['C'] = NAME_KEEP, ['D'] = NAME_KEEP,
+	['E'] = NAME_KEEP, ['F'] = NAME_KEEP, ['G'] = NAME_KEEP, ['H'] = NAME_KEEP,
+	['I'] = NAME_KEEP, ['J'] = NAME_KEEP, ['K'] = NAME_KEEP, ['L'] = NAME_KEEP,
+	['M'] = NAME_KEEP, ['N'] = NAME_KEEP, ['O'] = NAME_KEEP, ['P'] = NAME_KEEP,
+	['Q'] = NAME_KEEP, ['R'] = NAME_KEEP, ['S'] = NAME_KEEP, ['T'] = NAME_KEEP,
+	['U'] = NAME_KEEP, ['V'] = NAME_KEEP, ['W'] = NAME_KEEP, ['X'] = NAME_KEEP,
+	['Y'] = NAME_KEEP, ['Z'] = NAME_KEEP,
+	['0'] = NAME_KEEP, ['1'] = NAME_KEEP, ['2'] = NAME_KEEP, ['3'] = NAME_KEEP,
+	['4'] = NAME_KEEP, ['5'] = NAME_KEEP, ['6'] = NAME_KEEP, ['7'] = NAME_KEEP,
+	['8'] = NAME_KEEP, ['9'] = NAME_KEEP,
+	['-'] = NAME_KEEP, ['_'] = NAME_KEEP, [' '] = NAME_KEEP,
+	['.'] = NAME_DOT,
+	[0xc2] = NAME_UTF8, [0xc3] = NAME_UTF8, [0xc4] = NAME_UTF8, [0xc5] = NAME_UTF8,
+	[0xc6] = NAME_UTF8, [0xc7] = NAME_UTF8, [0xc8] = NAME_UTF8, [0xc9] = NAME_UTF8,
+	[0xca] = NAME_UTF8, [0xcb] = NAME_UTF8, [0xcc] = NAME_UTF8, [0xcd] = NAME_UTF8,
+	[0xce] = NAME_UTF8, [0xcf] = NAME_UTF8, [0xd0] = NAME_UTF8, [0xd1] = NAME_UTF8,
+	[0xd2] = NAME_UTF8, [0xd3] = NAME_UTF8, [0xd4] = NAME_UTF8, [0xd5] = NAME_UTF8,
+	[0xd6] = NAME_UTF8, [0xd7] = NAME_UTF8, [0xd8] = NAME_UTF8, [0xd9] = NAME_UTF8,
+	[0xda] = NAME_UTF8, [0xdb] = NAME_UTF8, [0xdc] = NAME_UTF8, [0xdd] = NAME_UTF8,
+	[0xde] = NAME_UTF8, [0xdf] = NAME_UTF8, [0xe0] = NAME_UTF8, [0xe1] = NAME_UTF8,
+	[0xe2] = NAME_UTF8, [0xe3] = NAME_UTF8, [0xe4] = NAME_UTF8, [0xe5] = NAME_UTF8,
+	[0xe6] = NAME_UTF8, [0xe7] = NAME_UTF8, [0xe8] = NAME_UTF8, [0xe9] = NAME_UTF8,
+	[0xea] = NAME_UTF8, [0xeb] = NAME_UTF8, [0xec] = NAME_UTF8, [0xed] = NAME_UTF8,
+	[0xee] = NAME_UTF8, [0xef] = NAME_UTF8, [0xf0] = NAME_UTF8, [0xf1] = NAME_UTF8,
+	[0xf2] = NAME_UTF8, [0xf3] = NAME_UTF8, [0xf4] = NAME_UTF8,
+};
+
+// ASCII spelling of U+00C0 to U+00FF, NULL to hex-encode
+static const char *latinTable[64] = {
+	"A", "A", "A", "A", "A", "A", "AE", "C",
+	"E", "E", "E", "E", "I", "I", "I", "I",
+	"D", "N", "O", "O", "O", "O", "O", NULL,
+	"O", "U", "U", "U", "U", "Y", "Th", "ss",
+	"a", "a", "a", "a", "a", "a", "ae", "c",
+	"e", "e", "e", "e", "i", "i", "i", "i",
+	"d", "n", "o", "o", "o", "o", "o", NULL,
+	"o", "u", "u", "u", "u", "y", "th", "y",
+};
+
+static size_t
+decodeUtf8(const unsigned char *s, unsigned long *cp)
+{
+	// Returns the length of the sequence at s, or 0 if it is invalid.
+
+	size_t len;
+
+	if (s[0] < 0xe0) {
+		len = 2;
+		*cp = s[0] & 0x1f;
+	} else if (s[0] < 0xf0) {
+		len = 3;
+		*cp = s[0] & 0x0f;
+	} else {
+		len = 4;
+		*cp = s[0] & 0x07;
+	}
+
+	for (size_t i = 1; i < len; i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		*cp = (*cp << 6) | (s[i] & 0x3f);
+	}
+
+	return len;
+}
+
+static size_t
+putHex(char *out, unsigned long value, int digits)
+{
+	// Write value in lowercase hex, with at least digits digits.
+
+	static const char hexDigits[] = "0123456789abcdef";
+	char tmp[16];
+	size_t len = 0;
+
+	do {
+		tmp[len++] = hexDigits[value & 0xf];
+		value >>= 4;
+	} while (value || (int) len < digits);
+
+	for (size_t i = 0; i < len; i++)
+		out[i] = tmp[len - 1 - i];
+
+	return len;
+}
+
+static int
+transliterate(unsigned long cp, char *out)
+{
+	// Write an ASCII replacement for a code point, which may be empty.
+	// Returns its length.
+
+	const char *repl = NULL;
+
+	if (cp >= 0xc0 && cp <= 0xff)
+		repl = latinTable[cp - 0xc0];
+	else if (cp == 0xa0)
+		repl = " ";
+	else if (cp >= 0x2010 && cp <= 0x2015)
+		repl = "-";
+	else if ((cp >= 0x80 && cp < 0xc0) || (cp >= 0x2016 && cp <= 0x206f))
+		// Symbols and punctuation are dropped, like in ASCII
+		repl = "";
+
+	if (repl) {
+		size_t len = strlen(repl);
+		memcpy(out, repl, len);
+		return len;
+	}
+
+	out[0] = 'u';
+	return putHex(out + 1, cp, 1) + 1;
+}
+
+size_t
+sanitize(char *dst, size_t size, const char *title, const char *key)
+{
+	// Write a safe file name for an article to dst, which holds size bytes.
+	// Without key, the name is the one MinRSS 0.4 gave: the first
+	// MAX_NAME bytes of the title, without non-ASCII characters.
+	// With key, non-ASCII characters are transliterated or written as
+	// u[hex code], and a hash of key is appended, so that articles with
+	// the same title get distinct, stable names.
+	// Returns the length of the name.
+
+	char suffix[18] = "";
+	size_t suffixLen = 0;
+
+	if (key) {
+		uint64_t hash = hash64(key, strlen(key));
+		suffix[0] = '-';
+		suffixLen = putHex(suffix + 1, (hash ^ (hash >> 32)) & 0xffffffff, 8) + 1;
+		suffix[suffixLen] = '\0';
+	}
+
+	if (size < suffixLen + 2) {
+		if (size)
+			dst[0] = '\0';
+		return 0;
+	}
+
+	// Room left for the title part
+	size_t max = size - 1 - suffixLen;
+	size_t len = 0;
+
+	const unsigned char *s = (const unsigned char *) (title ? title : "");
+	const unsigned char *end = s + strlen((const char *) s);
+
+	if (!key && end - s > MAX_NAME)
+		end = s + MAX_NAME;
+
+	while (s < end && len < max) {
+		// Filter runs of ASCII a word at a time, skipping the UTF-8
+		// handling. Dots are only special at the start of the name.
+		uint64_t word;
+		while (len && end - s >= 8 && len + 8 <= max) {
+			memcpy(&word, s, 8);
+			if (word & 0x8080808080808080ULL)
+				break;
+
+			for (int i = 0; i < 8; i++, s++)
+				if (nameTable[*s])
+					dst[len++] = *s;
+		}
+
+		if (s >= end || len >= max)
+			break;
+
+		unsigned long cp;
+		size_t seqLen;
+		char repl[16];
+		int replLen;
+
+		switch (nameTable[*s]) {
+			case NAME_KEEP:
+				dst[len++] = *s++;
+				break;
+			case NAME_DOT:
+				// Avoid hidden files, and "." or ".."
+				if (len)
+					dst[len++] = *s;
+				s++;
+				break;
+			case NAME_UTF8:
+				seqLen = key ? decodeUtf8(s, &cp) : 0;
+				if (!seqLen) {
+					s++;
+					break;
+				}
+				replLen = transliterate(cp, repl);
+				// Never split a replacement
+				if (len + replLen > max) {
+					max = len;
+					break;
+				}
+				memcpy(dst + len, repl, replLen);
+				len += replLen;
+				s += seqLen;
+				break;
+			default:
+				s++;
+				break;
+		}
+	}
+
+	// Do not start names with a dash
+	if (!len && suffixLen) {
+		memcpy(dst, suffix + 1, suffixLen);
+		return suffixLen - 1;
+	}
+
+	memcpy(dst + len, suffix, suffixLen + 1);
+
+	return len + suffixLen;
+}
+
 char *
-san(char *str)
+joinPath(const char *folder, const char *name)
 {
-	if (!str)
-		return "";
+	// Allocates [folder]/[name], caller frees.
 
-	unsigned long long int len = strlen(str);
-	unsigned long long int offset = 0;
+	size_t folderLen = strlen(folder);
+	size_t nameLen = strlen(name);
 
-	len = len > 255 ? 255 : len;
+	char *path = ecalloc(folderLen + 1 + nameLen + 1, sizeof(char));
 
-	char *dup = ecalloc(len + 1, sizeof(char));
-	memcpy(dup, str, (len + 1) * sizeof(char));
+	memcpy(path, folder, folderLen);
+	path[folderLen] = fsep();
+	memcpy(path + folderLen + 1, name, nameLen + 1);
 
-	for (unsigned long long int i = 0; i < len; i++) {
-		char c = dup[i];
+	return path;
+}
 
-		if ((c >= 'a' && c <= 'z') ||
-		        (c >= 'A' && c <= 'Z') ||
-		        (c >= '0' && c <= '9') ||
-		        (c == '.' && i - offset != 0) ||
-		        c == '-' || c == '_' ||
-		        c == ' ')
-			dup[i - offset] = dup[i];
-		else
-			offset++;
+int
+makeDir(const char *path)
+{
+	// Create a directory, which may already exist.
+
+	if (mkdir(path, S_IRWXU) && errno != EEXIST) {
+		logMsg(LOG_ERROR, "Error creating directory %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+uint64_t
+fnv1a(const char *str, size_t len)
+{
+	// 64-bit FNV-1a. Its values are kept in .seen files, so it must not
+	// change: use hash64() for anything new.
+
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char) str[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+uint64_t
+hash64(const char *str, size_t len)
+{
+	// FNV-1a with a final mix so all bits depend on the input, used for
+	// names and hash tables.
+
+	uint64_t hash = fnv1a(str, len);
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+int
+jumpHash(uint64_t key, int buckets)
+{
+	// Jump consistent hash (Lamping and Veach): going from n to n + 1
+	// buckets only moves 1 / (n + 1) of the keys, all into the new one.
+
+	int64_t b = -1, j = 0;
+
+	while (j < buckets) {
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (b + 1) * ((double) (1LL << 31) / (double) ((key >> 33) + 1));
 	}
 
-	dup[len-offset] = '\0';
+	return b;
+}
+
+long long
+monoNsec()
+{
+	// Monotonic clock in nanoseconds, for timing measurements.
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	return dup;
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
 char fsep()
@@ -9,10 +9,33 @@ You should have received a copy of the GNU General Public License along with thi
 © 2021 dogeystamp <dogeystamp@disroot.org>
 */
 
+#include <stdint.h>
+
 #define LEN(X) (sizeof(X) / sizeof(X[0]))
 
-void logMsg(int argc, char *msg, ...);
+// Longest file name, in bytes
+#define MAX_NAME 255
+
+// Arguments are not evaluated when the level is disabled.
+#define logMsg(lvl, ...) do { \
+	if ((lvl) <= curLogLevel) \
+		logWrite((lvl), __VA_ARGS__); \
+} while (0)
+
+extern int curLogLevel;
+
+void initLog();
+int setLogLevel(const char *name);
+void setLogFormat(int format);
+void setLogFeed(const char *feedName);
+void logWrite(int lvl, char *msg, ...);
 void *ecalloc(size_t nmemb, size_t size);
 void *erealloc(void *p, size_t nmemb);
-char *san(char *str);
+size_t sanitize(char *dst, size_t size, const char *title, const char *key);
+char *joinPath(const char *folder, const char *name);
+int makeDir(const char *path);
+uint64_t fnv1a(const char *str, size_t len);
+uint64_t hash64(const char *str, size_t len);
+int jumpHash(uint64_t key, int buckets);
+long long monoNsec();
 char fsep();
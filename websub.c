@@ -0,0 +1,720 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <curl/curl.h>
+
+#include "config.h"
+#include "util.h"
+#include "net.h"
+#include "stats.h"
+#include "websub.h"
+
+/*
+	WebSub subscriber for 'minrss serve'.
+
+	Feeds that name a hub are subscribed to it, with callbackUrl followed
+	by a random token for the feed as the callback. The token is all that
+	tells hubs apart from anyone else, so callbackUrl should be HTTPS
+	(through a reverse proxy) on networks that can not be trusted.
+
+	Hubs verify each subscription with a GET request to the callback,
+	which is only confirmed if MinRSS asked for it, then POST new versions
+	of the feed to it. The state of each subscription is kept in
+	.minrss/feeds/[feed].websub as "[key] [value]" lines.
+
+	When a feed moves to another hub, or stops naming one, the former hub
+	is asked to unsubscribe, and its callback is only kept to confirm
+	that. The new subscription gets a token of its own.
+*/
+
+#define TOKEN_LEN 32
+#define MAX_URL 2048
+#define MAX_HEADER 16384
+
+// Hubs that did not verify a subscription in this time are asked again
+#define PENDING_TIME 3600
+// Clients that take longer than this to send a request are dropped, in
+// seconds
+#define CLIENT_TIMEOUT 10
+
+typedef struct {
+	char *hub;
+	char *topic;
+	char token[TOKEN_LEN + 1];
+	time_t subscribedAt;
+	time_t leaseUntil;
+	// Set while a subscription waits to be verified by the hub
+	time_t pendingUntil;
+
+	outputStruct output;
+	int queued;
+
+	// Former subscription to cancel
+	char *oldHub;
+	char *oldTopic;
+	char oldToken[TOKEN_LEN + 1];
+	outputStruct oldOutput;
+	int oldQueued;
+	// Set once the former hub accepted the request
+	int oldSent;
+} subStruct;
+
+// One per entry in links[], once openCallback() was called
+static subStruct *subs;
+
+static char *
+copyStr(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *copy = ecalloc(len, sizeof(char));
+	memcpy(copy, str, len);
+
+	return copy;
+}
+
+static char *
+subPath(const char *feedName)
+{
+	char *feedsDir = joinPath(stateDir, "feeds");
+	char *name = ecalloc(strlen(feedName) + 8, sizeof(char));
+
+	sprintf(name, "%s.websub", feedName);
+	char *path = joinPath(feedsDir, name);
+
+	free(name);
+	free(feedsDir);
+
+	return path;
+}
+
+static void
+loadSub(size_t feed)
+{
+	subStruct *sub = &subs[feed];
+	char *path = subPath(links[feed].feedName);
+	FILE *f = fopen(path, "r");
+	free(path);
+
+	if (!f)
+		return;
+
+	char key[32];
+	char *value = ecalloc(MAX_URL, sizeof(char));
+
+	while (fscanf(f, "%31s %2047s", key, value) == 2) {
+		if (!strcmp(key, "hub")) {
+			free(sub->hub);
+			sub->hub = copyStr(value);
+		} else if (!strcmp(key, "topic")) {
+			free(sub->topic);
+			sub->topic = copyStr(value);
+		} else if (!strcmp(key, "token") && strlen(value) == TOKEN_LEN) {
+			strcpy(sub->token, value);
+		} else if (!strcmp(key, "subscribed")) {
+			sub->subscribedAt = strtoll(value, NULL, 10);
+		} else if (!strcmp(key, "until")) {
+			sub->leaseUntil = strtoll(value, NULL, 10);
+		} else if (!strcmp(key, "oldhub")) {
+			free(sub->oldHub);
+			sub->oldHub = copyStr(value);
+		} else if (!strcmp(key, "oldtopic")) {
+			free(sub->oldTopic);
+			sub->oldTopic = copyStr(value);
+		} else if (!strcmp(key, "oldtoken") && strlen(value) == TOKEN_LEN) {
+			strcpy(sub->oldToken, value);
+		}
+	}
+
+	free(value);
+	fclose(f);
+
+	if (!sub->topic)
+		sub->topic = copyStr(links[feed].url);
+
+	if (!sub->oldHub || !sub->oldTopic || !sub->oldToken[0]) {
+		free(sub->oldHub);
+		free(sub->oldTopic);
+		sub->oldHub = sub->oldTopic = NULL;
+		sub->oldToken[0] = '\0';
+	}
+}
+
+static int
+saveSub(size_t feed)
+{
+	subStruct *sub = &subs[feed];
+	char *feedsDir = joinPath(stateDir, "feeds");
+	int err = makeDir(stateDir) || makeDir(feedsDir);
+	free(feedsDir);
+
+	if (err)
+		return 1;
+
+	char *path = subPath(links[feed].feedName);
+	FILE *f = fopen(path, "w");
+
+	if (!f) {
+		logMsg(LOG_ERROR, "Could not write %s.\n", path);
+		free(path);
+		return 1;
+	}
+
+	if (sub->hub)
+		fprintf(f, "hub %s\ntopic %s\n", sub->hub, sub->topic);
+	if (sub->token[0])
+		fprintf(f, "token %s\n", sub->token);
+	fprintf(f, "subscribed %lld\n", (long long) sub->subscribedAt);
+	fprintf(f, "until %lld\n", (long long) sub->leaseUntil);
+	if (sub->oldHub)
+		fprintf(f, "oldhub %s\noldtopic %s\noldtoken %s\n", sub->oldHub, sub->oldTopic, sub->oldToken);
+
+	fclose(f);
+	free(path);
+
+	return 0;
+}
+
+static int
+newToken(subStruct *sub)
+{
+	unsigned char bytes[TOKEN_LEN / 2];
+	FILE *f = fopen("/dev/urandom", "rb");
+
+	if (!f || fread(bytes, 1, sizeof(bytes), f) != sizeof(bytes)) {
+		logMsg(LOG_ERROR, "Could not read /dev/urandom.\n");
+		if (f)
+			fclose(f);
+		return 1;
+	}
+
+	fclose(f);
+
+	for (size_t i = 0; i < sizeof(bytes); i++)
+		sprintf(sub->token + 2 * i, "%02x", bytes[i]);
+
+	return 0;
+}
+
+int
+openCallback()
+{
+	// Load the subscriptions and listen for hubs.
+	// Returns the listening socket, or -1 on error.
+
+	subs = ecalloc(LEN(links), sizeof(subStruct));
+
+	for (size_t i = 0; i < LEN(links); i++)
+		loadSub(i);
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if (getaddrinfo(listenAddr[0] ? listenAddr : NULL, listenPort, &hints, &res))
+		return -1;
+
+	int sock = -1;
+
+	for (struct addrinfo *ai = res; ai && sock < 0; ai = ai->ai_next) {
+		sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (sock < 0)
+			continue;
+
+		int on = 1;
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+		if (bind(sock, ai->ai_addr, ai->ai_addrlen) || listen(sock, 16)) {
+			close(sock);
+			sock = -1;
+		}
+	}
+
+	freeaddrinfo(res);
+
+	return sock;
+}
+
+int
+pushedFeed(size_t feed, time_t now)
+{
+	// Returns 1 if a hub pushes the feed's updates, so that it need not
+	// be polled. Subscriptions are renewed in the last tenth of their
+	// lease, when the feed is polled again.
+
+	if (!subs || !subs[feed].hub)
+		return 0;
+
+	subStruct *sub = &subs[feed];
+
+	return sub->leaseUntil - now > (sub->leaseUntil - sub->subscribedAt) / 10;
+}
+
+static int
+queueRequest(outputStruct *output, const char *hub, const char *mode,
+             const char *topic, const char *token)
+{
+	// Queue a subscription request for performRequests(). Returns 0 if
+	// it was queued.
+
+	size_t len = strlen(callbackUrl);
+	char *callback = ecalloc(len + TOKEN_LEN + 2, sizeof(char));
+	sprintf(callback, "%s%s%s", callbackUrl, callbackUrl[len - 1] == '/' ? "" : "/", token);
+
+	char *escTopic = curl_easy_escape(NULL, topic, 0);
+	char *escCallback = curl_easy_escape(NULL, callback, 0);
+	char *fields = ecalloc(strlen(escTopic) + strlen(escCallback) + 128, sizeof(char));
+
+	sprintf(fields, "hub.mode=%s&hub.topic=%s&hub.callback=%s", mode, escTopic, escCallback);
+	if (!strcmp(mode, "subscribe"))
+		sprintf(fields + strlen(fields), "&hub.lease_seconds=%ld", leaseSeconds);
+
+	memset(output, 0, sizeof(outputStruct));
+	int err = createPost(hub, output, fields);
+
+	curl_free(escTopic);
+	curl_free(escCallback);
+	free(fields);
+	free(callback);
+
+	return err;
+}
+
+void
+noteHub(size_t feed, const char *hub, const char *topic)
+{
+	// Called after polling a feed, with the hub it names ("" for none)
+	// and its topic (NULL for its URL), or with a NULL hub to keep the
+	// known one. Subscribes to the hub unless that is already done.
+
+	if (!subs)
+		return;
+
+	subStruct *sub = &subs[feed];
+	time_t now = time(NULL);
+
+	if (!topic)
+		topic = links[feed].url;
+
+	if (hub && (hub[0] ? !sub->hub || strcmp(sub->hub, hub) || strcmp(sub->topic, topic) : !!sub->hub)) {
+		if (sub->hub && sub->token[0] && (sub->leaseUntil > now || sub->pendingUntil > now)) {
+			// The former hub keeps pushing until it is told to stop.
+			free(sub->oldHub);
+			free(sub->oldTopic);
+			sub->oldHub = sub->hub;
+			sub->oldTopic = sub->topic;
+			strcpy(sub->oldToken, sub->token);
+			sub->oldSent = 0;
+			sub->token[0] = '\0';
+		} else {
+			free(sub->hub);
+			free(sub->topic);
+		}
+
+		sub->hub = hub[0] ? copyStr(hub) : NULL;
+		sub->topic = copyStr(topic);
+		sub->subscribedAt = sub->leaseUntil = sub->pendingUntil = 0;
+		saveSub(feed);
+	}
+
+	if (callbackUrl[0] && sub->oldHub && !sub->oldSent && !sub->oldQueued) {
+		logMsg(LOG_VERBOSE, "Unsubscribing from %s through %s\n", sub->oldTopic, sub->oldHub);
+		sub->oldQueued = !queueRequest(&sub->oldOutput, sub->oldHub, "unsubscribe",
+		                               sub->oldTopic, sub->oldToken);
+	}
+
+	if (!callbackUrl[0] || !sub->hub || sub->pendingUntil > now || pushedFeed(feed, now))
+		return;
+
+	if (!sub->token[0]) {
+		if (newToken(sub))
+			return;
+		saveSub(feed);
+	}
+
+	logMsg(LOG_VERBOSE, "Subscribing to %s through %s\n", sub->topic, sub->hub);
+
+	sub->queued = !queueRequest(&sub->output, sub->hub, "subscribe", sub->topic, sub->token);
+	sub->pendingUntil = now + PENDING_TIME;
+}
+
+static void
+subscribed(char *url, long responseCode)
+{
+	// Hubs accept requests with 202 Accepted, then verify them.
+
+	if (responseCode != 202 && responseCode != 204)
+		logMsg(LOG_ERROR, "Hub %s refused a request (HTTP %ld).\n", url, responseCode);
+}
+
+int
+sendSubscriptions()
+{
+	// Send the subscription requests queued by noteHub().
+	// Returns the number that failed.
+
+	size_t queued = 0, failed = 0;
+
+	for (size_t i = 0; subs && i < LEN(links); i++)
+		queued += subs[i].queued + subs[i].oldQueued;
+
+	if (!queued)
+		return 0;
+
+	performRequests(subscribed);
+
+	for (size_t i = 0; i < LEN(links); i++) {
+		subStruct *sub = &subs[i];
+
+		if (sub->oldQueued) {
+			// Sent again the next time the feed is polled if it failed
+			sub->oldSent = !requestFailed(&sub->oldOutput);
+			failed += !sub->oldSent;
+
+			free(sub->oldOutput.buffer);
+			sub->oldOutput.buffer = NULL;
+			sub->oldQueued = 0;
+		}
+
+		if (!sub->queued)
+			continue;
+
+		// Try again the next time the feed is polled.
+		if (requestFailed(&sub->output)) {
+			sub->pendingUntil = 0;
+			failed++;
+		}
+
+		free(sub->output.buffer);
+		sub->output.buffer = NULL;
+		sub->queued = 0;
+	}
+
+	return failed;
+}
+
+static void
+respond(int conn, int code, const char *reason, const char *body)
+{
+	char head[256];
+	int len = snprintf(head, sizeof(head),
+	                   "HTTP/1.1 %d %s\r\n"
+	                   "Content-Type: text/plain\r\n"
+	                   "Content-Length: %zu\r\n"
+	                   "Connection: close\r\n\r\n",
+	                   code, reason, strlen(body));
+
+	send(conn, head, len, MSG_NOSIGNAL);
+	send(conn, body, strlen(body), MSG_NOSIGNAL);
+}
+
+static const char *
+findHeader(const char *headers, const char *name)
+{
+	// Returns the value of a header, given the request line and headers.
+
+	size_t len = strlen(name);
+
+	for (const char *line = strstr(headers, "\r\n"); line; line = strstr(line, "\r\n")) {
+		line += 2;
+
+		if (!strncasecmp(line, name, len) && line[len] == ':') {
+			line += len + 1;
+			while (*line == ' ' || *line == '\t')
+				line++;
+			return line;
+		}
+	}
+
+	return NULL;
+}
+
+static char *
+queryParam(const char *query, const char *name)
+{
+	// Returns the decoded value of a query parameter, to be freed with
+	// curl_free(), or NULL.
+
+	size_t len = strlen(name);
+
+	for (const char *param = query; param; param = strchr(param, '&')) {
+		if (*param == '&')
+			param++;
+
+		if (strncmp(param, name, len) || param[len] != '=')
+			continue;
+
+		const char *value = param + len + 1;
+		size_t valueLen = strcspn(value, "&");
+		char *copy = ecalloc(valueLen + 1, sizeof(char));
+
+		for (size_t i = 0; i < valueLen; i++)
+			copy[i] = value[i] == '+' ? ' ' : value[i];
+
+		char *decoded = curl_easy_unescape(NULL, copy, valueLen, NULL);
+		free(copy);
+
+		return decoded;
+	}
+
+	return NULL;
+}
+
+static void
+verifyOld(int conn, size_t feed, const char *query)
+{
+	// Answer the former hub of a feed checking that MinRSS asked to
+	// unsubscribe.
+
+	subStruct *sub = &subs[feed];
+
+	char *mode = query ? queryParam(query, "hub.mode") : NULL;
+	char *topic = query ? queryParam(query, "hub.topic") : NULL;
+	char *challenge = query ? queryParam(query, "hub.challenge") : NULL;
+
+	if (mode && !strcmp(mode, "unsubscribe") && challenge && topic &&
+	        !strcmp(topic, sub->oldTopic)) {
+		logMsg(LOG_INFO, "Unsubscribed from %s at %s.\n", sub->oldTopic, sub->oldHub);
+		respond(conn, 200, "OK", challenge);
+
+		free(sub->oldHub);
+		free(sub->oldTopic);
+		sub->oldHub = sub->oldTopic = NULL;
+		sub->oldToken[0] = '\0';
+		saveSub(feed);
+	} else {
+		respond(conn, 404, "Not Found", "");
+	}
+
+	curl_free(mode);
+	curl_free(topic);
+	curl_free(challenge);
+}
+
+static void
+verifyIntent(int conn, size_t feed, const char *query)
+{
+	// Answer a hub checking that MinRSS asked for a subscription.
+
+	subStruct *sub = &subs[feed];
+	time_t now = time(NULL);
+
+	char *mode = query ? queryParam(query, "hub.mode") : NULL;
+	char *topic = query ? queryParam(query, "hub.topic") : NULL;
+	char *challenge = query ? queryParam(query, "hub.challenge") : NULL;
+	char *lease = query ? queryParam(query, "hub.lease_seconds") : NULL;
+
+	if (mode && !strcmp(mode, "denied")) {
+		logMsg(LOG_ERROR, "%s refused the subscription to %s.\n", sub->hub, sub->topic);
+		sub->pendingUntil = 0;
+		sub->leaseUntil = 0;
+		saveSub(feed);
+		respond(conn, 200, "OK", "");
+	} else if (mode && !strcmp(mode, "subscribe") && challenge && topic &&
+	           sub->pendingUntil > now && !strcmp(topic, sub->topic)) {
+		long seconds = lease ? atol(lease) : 0;
+		if (seconds <= 0)
+			seconds = leaseSeconds;
+
+		sub->subscribedAt = now;
+		sub->leaseUntil = now + seconds;
+		sub->pendingUntil = 0;
+		saveSub(feed);
+
+		logMsg(LOG_INFO, "Subscribed to %s for %ld s.\n", sub->topic, seconds);
+		respond(conn, 200, "OK", challenge);
+	} else {
+		respond(conn, 404, "Not Found", "");
+	}
+
+	curl_free(mode);
+	curl_free(topic);
+	curl_free(challenge);
+	curl_free(lease);
+}
+
+static ssize_t
+recvBefore(int conn, char *buf, size_t len, long long deadline)
+{
+	// recv() that gives up at deadline (from monoNsec()), or when asked
+	// to stop. Returns -1 then.
+
+	struct pollfd pfds[2] = {
+		{ .fd = conn, .events = POLLIN },
+		{ .fd = stopFd(), .events = POLLIN },
+	};
+
+	long long left = (deadline - monoNsec()) / 1000000;
+
+	if (left <= 0 || stopRequested() || poll(pfds, 2, left) <= 0 || pfds[1].revents)
+		return -1;
+
+	return recv(conn, buf, len, 0);
+}
+
+static char *
+readBody(int conn, const char *headers, const char *start, size_t have, long long deadline)
+{
+	// Read the body of a request, given what was read after the headers.
+	// Returns NULL (after answering) if it can not be accepted.
+
+	const char *length = findHeader(headers, "Content-Length");
+	const char *encoding = findHeader(headers, "Transfer-Encoding");
+
+	if (!length || encoding) {
+		respond(conn, 411, "Length Required", "");
+		return NULL;
+	}
+
+	long long size = strtoll(length, NULL, 10);
+
+	if (size < 0 || (maxFeedSize && size > maxFeedSize)) {
+		respond(conn, 413, "Content Too Large", "");
+		statAdd(STAT_LIMIT_SIZE, 1);
+		return NULL;
+	}
+
+	if (have > (size_t) size)
+		have = size;
+
+	char *body = ecalloc(size + 1, sizeof(char));
+	memcpy(body, start, have);
+
+	while (have < (size_t) size) {
+		ssize_t n = recvBefore(conn, body + have, size - have, deadline);
+		if (n <= 0) {
+			free(body);
+			return NULL;
+		}
+		have += n;
+	}
+
+	return body;
+}
+
+long
+serveCallback(int sock, long timeout, char **body)
+{
+	// Wait up to timeout ms for a request from a hub, and answer it.
+	// Returns the feed whose update was pushed, with the document in
+	// body, or -1. Without a socket, only waits. Returns early when
+	// asked to stop.
+
+	struct pollfd pfds[2] = {
+		{ .fd = sock, .events = POLLIN },
+		{ .fd = stopFd(), .events = POLLIN },
+	};
+
+	if (poll(pfds, 2, timeout) <= 0 || pfds[1].revents || !(pfds[0].revents & POLLIN))
+		return -1;
+
+	int conn = accept(sock, NULL, NULL);
+	if (conn < 0)
+		return -1;
+
+	// The whole request must arrive in time, not just each part of it.
+	long long deadline = monoNsec() + CLIENT_TIMEOUT * 1000000000LL;
+
+	struct timeval limit = {
+		.tv_sec = CLIENT_TIMEOUT,
+	};
+	setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof(limit));
+
+	char *buf = ecalloc(MAX_HEADER + 1, sizeof(char));
+	char *end = NULL;
+	size_t len = 0;
+	long feed = -1;
+
+	while (!end && len < MAX_HEADER) {
+		ssize_t n = recvBefore(conn, buf + len, MAX_HEADER - len, deadline);
+		if (n <= 0)
+			break;
+		len += n;
+		buf[len] = '\0';
+		end = strstr(buf, "\r\n\r\n");
+	}
+
+	// Split the request line into method, target and version.
+	char *target = end ? strchr(buf, ' ') : NULL;
+	char *version = target ? strchr(target + 1, ' ') : NULL;
+
+	if (!version || version > end) {
+		respond(conn, 400, "Bad Request", "");
+		goto done;
+	}
+
+	end[2] = '\0';
+	*target++ = '\0';
+	*version++ = '\0';
+
+	char *query = strchr(target, '?');
+	if (query)
+		*query++ = '\0';
+
+	char *token = strrchr(target, '/');
+	token = token ? token + 1 : target;
+
+	// Set if the token is that of a former subscription
+	int old = 0;
+
+	for (size_t i = 0; strlen(token) == TOKEN_LEN && i < LEN(links); i++) {
+		if (!strcmp(subs[i].token, token)) {
+			feed = i;
+		} else if (!strcmp(subs[i].oldToken, token)) {
+			feed = i;
+			old = 1;
+		}
+	}
+
+	if (feed < 0) {
+		respond(conn, 404, "Not Found", "");
+	} else if (old && !strcmp(buf, "GET")) {
+		verifyOld(conn, feed, query);
+		feed = -1;
+	} else if (old) {
+		respond(conn, 410, "Gone", "");
+		feed = -1;
+	} else if (!strcmp(buf, "GET")) {
+		verifyIntent(conn, feed, query);
+		feed = -1;
+	} else if (strcmp(buf, "POST")) {
+		respond(conn, 405, "Method Not Allowed", "");
+		feed = -1;
+	} else if (subs[feed].leaseUntil <= time(NULL) && subs[feed].pendingUntil <= time(NULL)) {
+		// Tells the hub to stop sending updates
+		respond(conn, 410, "Gone", "");
+		feed = -1;
+	} else if ((*body = readBody(conn, version, end + 4, len - (end + 4 - buf), deadline))) {
+		respond(conn, 202, "Accepted", "");
+		statAdd(STAT_PUSHES, 1);
+		statAdd(STAT_PUSH_BYTES, strlen(*body));
+	} else {
+		feed = -1;
+	}
+
+done:
+	free(buf);
+	close(conn);
+
+	return feed;
+}
@@ -0,0 +1,19 @@
+/*
+
+This program is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation; either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with this program. If not, see https://www.gnu.org/licenses/.
+
+© 2026 dogeystamp <dogeystamp@disroot.org>
+*/
+
+#include <stddef.h>
+#include <time.h>
+
+int openCallback();
+int pushedFeed(size_t feed, time_t now);
+void noteHub(size_t feed, const char *hub, const char *topic);
+int sendSubscriptions();
+long serveCallback(int sock, long timeout, char **body);